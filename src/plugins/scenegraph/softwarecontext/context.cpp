@@ -34,7 +34,9 @@
 #include "painternode.h"
 #include "pixmaptexture.h"
 #include "glyphnode.h"
+#include "glyphcache.h"
 #include "ninepatchnode.h"
+#include "pixmappool.h"
 #include "renderingvisitor.h"
 #include "softwarelayer.h"
 
@@ -51,6 +53,9 @@
 #include <private/qsgdefaultrectanglenode_p.h>
 #include <private/qsgdistancefieldglyphnode_p_p.h>
 #include <private/qsgdefaultglyphnode_p.h>
+#include <private/qquickitem_p.h>
+#include <QtQuick/QSGSimpleRectNode>
+#include <QtQuick/QSGSimpleTextureNode>
 
 #ifndef QSG_NO_RENDERER_TIMING
 static bool qsg_render_timing = !qgetenv("QSG_RENDER_TIMING").isEmpty();
@@ -84,6 +89,8 @@ namespace SoftwareContext
 
 Renderer::Renderer(QSGRenderContext *context)
     : QSGRenderer(context)
+    , m_fullRepaint(true)
+    , m_previousDevicePixelRatio(0)
 {
 }
 
@@ -105,32 +112,111 @@ void Renderer::render()
     if (!m_backingStore)
         m_backingStore.reset(new QBackingStore(currentWindow));
 
-    if (m_backingStore->size() != currentWindow->size())
+    if (m_backingStore->size() != currentWindow->size()) {
         m_backingStore->resize(currentWindow->size());
+        m_fullRepaint = true;
+    }
+
+    //Settings outside the node tree change every pixel of the window
+    if (clearColor() != m_previousClearColor || devicePixelRatio() != m_previousDevicePixelRatio) {
+        m_previousClearColor = clearColor();
+        m_previousDevicePixelRatio = devicePixelRatio();
+        m_fullRepaint = true;
+    }
 
     const QRect rect(0, 0, currentWindow->width(), currentWindow->height());
-    m_backingStore->beginPaint(rect);
+    QRegion region = m_fullRepaint ? QRegion() : damagedRegion() & rect;
+    const bool partial = !region.isEmpty();
+    if (!partial)
+        region = rect;
+
+    m_backingStore->beginPaint(region);
 
     QPaintDevice *device = m_backingStore->paintDevice();
     QPainter painter(device);
     painter.setRenderHint(QPainter::Antialiasing);
+    if (partial)
+        painter.setClipRegion(region);
     painter.setCompositionMode(QPainter::CompositionMode_Source);
     painter.fillRect(rect, clearColor());
     painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
     RenderingVisitor(&painter).visitChildren(rootNode());
+    painter.end();
 
     m_backingStore->endPaint();
-    m_backingStore->flush(rect);
+    m_backingStore->flush(region);
+
+    m_fullRepaint = false;
+    m_damagedPainterNodes.clear();
+    m_movedRectangleNodes.clear();
+    SoftwareContext::PixmapPool::trim();
+
+    if (QSG_RASTER_LOG_TIME_GLYPH().isDebugEnabled()) {
+        const int glyphCacheMisses = SoftwareContext::takeGlyphCacheMisses();
+        qCDebug(QSG_RASTER_LOG_TIME_GLYPH, "glyph masks rasterized while painting the frame: %d", glyphCacheMisses);
+    }
+}
+
+static QRegion sceneRegion(QSGNode *node, const QRegion &region)
+{
+    QTransform transform;
+    for (QSGNode *parent = node->parent(); parent; parent = parent->parent()) {
+        if (parent->type() == QSGNode::TransformNodeType)
+            transform *= static_cast<QSGTransformNode *>(parent)->matrix().toTransform();
+    }
+    if (transform.type() <= QTransform::TxTranslate && transform.dx() == qRound(transform.dx())
+            && transform.dy() == qRound(transform.dy())) {
+        return region.translated(qRound(transform.dx()), qRound(transform.dy()));
+    }
+
+    //Leave a pixel for antialiased edges of transformed items
+    QRegion mapped;
+    foreach (const QRect &rect, region.rects())
+        mapped |= transform.mapRect(QRectF(rect)).toAlignedRect().adjusted(-1, -1, 1, 1);
+    return mapped;
+}
+
+QRegion Renderer::damagedRegion() const
+{
+    QRegion region;
+    foreach (PainterNode *node, m_damagedPainterNodes)
+        region |= sceneRegion(node, node->paintedRegion());
+    foreach (RectangleNode *node, m_movedRectangleNodes) {
+        QRegion bounds = node->paintedRect().toAlignedRect().adjusted(-1, -1, 1, 1);
+        bounds |= node->rect().toAlignedRect().adjusted(-1, -1, 1, 1);
+        region |= sceneRegion(node, bounds);
+    }
+    return region;
 }
 
 void Renderer::nodeChanged(QSGNode *node, QSGNode::DirtyState state)
 {
+    //Painted items repainting their content and rectangles that only moved
+    //are tracked so that their damage can be repainted alone, anything else
+    //repaints the window
+    PainterNode *painterNode = 0;
+    RectangleNode *rectangleNode = 0;
+    if (state == QSGNode::DirtyMaterial && node->type() == QSGNode::GeometryNodeType)
+        painterNode = dynamic_cast<PainterNode *>(node);
+    if (state == QSGNode::DirtyGeometry && node->type() == QSGNode::GeometryNodeType) {
+        rectangleNode = dynamic_cast<RectangleNode *>(node);
+        if (rectangleNode && (rectangleNode->dirtyFlags() & (RectangleNode::DirtyFill | RectangleNode::DirtyBorder)))
+            rectangleNode = 0;
+    }
+
+    if (painterNode)
+        m_damagedPainterNodes.insert(painterNode);
+    else if (rectangleNode)
+        m_movedRectangleNodes.insert(rectangleNode);
+    else
+        m_fullRepaint = true;
 
     QSGRenderer::nodeChanged(node, state);
 }
 
 PixmapRenderer::PixmapRenderer(QSGRenderContext *context)
     : QSGRenderer(context)
+    , m_fullRepaint(true)
 {
 
 }
@@ -150,14 +236,111 @@ void PixmapRenderer::render()
 
 }
 
+void PixmapRenderer::nodeChanged(QSGNode *node, QSGNode::DirtyState state)
+{
+    //Forced updates carry no change of their own, nested layers send them
+    //after each grab and their new content is picked up in collectBounds
+    if (state != QSGNode::DirtyForceUpdate)
+        m_dirtyNodes.insert(node);
+
+    QSGRenderer::nodeChanged(node, state);
+}
+
+static QRectF paintedBounds(QSGNode *node)
+{
+    if (RectangleNode *rectangleNode = dynamic_cast<RectangleNode *>(node))
+        return rectangleNode->rect();
+    if (ImageNode *imageNode = dynamic_cast<ImageNode *>(node))
+        return imageNode->rect();
+    if (PainterNode *painterNode = dynamic_cast<PainterNode *>(node))
+        return QRectF(QPointF(), painterNode->size());
+    if (GlyphNode *glyphNode = dynamic_cast<GlyphNode *>(node))
+        return glyphNode->boundingRect();
+    if (NinePatchNode *ninePatchNode = dynamic_cast<NinePatchNode *>(node))
+        return ninePatchNode->bounds();
+    if (QSGSimpleRectNode *rectNode = dynamic_cast<QSGSimpleRectNode *>(node))
+        return rectNode->rect();
+    if (QSGSimpleTextureNode *textureNode = dynamic_cast<QSGSimpleTextureNode *>(node))
+        return textureNode->rect();
+    //Not painted by the rendering visitor
+    return QRectF();
+}
+
+void PixmapRenderer::collectBounds(QSGNode *node, const QTransform &transform, bool dirty,
+                                   QHash<QSGNode *, QRect> *bounds, QHash<QSGNode *, qint64> *layerKeys)
+{
+    dirty = dirty || m_dirtyNodes.contains(node);
+
+    //Images of other layers are damaged whenever that layer painted again
+    if (ImageNode *imageNode = dynamic_cast<ImageNode *>(node)) {
+        if (SoftwareLayer *layer = qobject_cast<SoftwareLayer *>(imageNode->texture())) {
+            const qint64 key = layer->pixmap().cacheKey();
+            layerKeys->insert(node, key);
+            if (m_previousLayerKeys.value(node) != key)
+                dirty = true;
+        }
+    }
+
+    QTransform nodeTransform = transform;
+    if (node->type() == QSGNode::TransformNodeType) {
+        nodeTransform = static_cast<QSGTransformNode *>(node)->matrix().toTransform() * transform;
+    } else if (node->type() == QSGNode::GeometryNodeType) {
+        const QRectF rect = paintedBounds(node);
+        if (!rect.isEmpty()) {
+            //Leave a pixel for antialiased edges
+            const QRect mapped = nodeTransform.mapRect(rect).toAlignedRect().adjusted(-1, -1, 1, 1);
+            bounds->insert(node, mapped);
+
+            const QRect previous = m_previousBounds.take(node);
+            if (dirty || previous != mapped) {
+                m_damage |= mapped;
+                m_damage |= previous;
+            }
+        }
+    }
+
+    for (QSGNode *child = node->firstChild(); child; child = child->nextSibling())
+        collectBounds(child, nodeTransform, dirty, bounds, layerKeys);
+}
+
 void PixmapRenderer::render(QPixmap *target)
 {
-    target->fill(clearColor());
+    if (m_projectionRect != m_previousProjectionRect) {
+        m_previousProjectionRect = m_projectionRect;
+        m_fullRepaint = true;
+    }
+
+    //Damage is collected in scene coordinates: where changed nodes are now,
+    //where they were, and where removed nodes were
+    QHash<QSGNode *, QRect> bounds;
+    QHash<QSGNode *, qint64> layerKeys;
+    m_damage = QRegion();
+    if (rootNode())
+        collectBounds(rootNode(), QTransform(), false, &bounds, &layerKeys);
+    foreach (const QRect &rect, m_previousBounds)
+        m_damage |= rect;
+    m_previousBounds.swap(bounds);
+    m_previousLayerKeys.swap(layerKeys);
+    m_dirtyNodes.clear();
+
+    if (!m_fullRepaint && m_damage.isEmpty())
+        return;
+
+    if (m_fullRepaint)
+        target->fill(clearColor());
     QPainter painter(target);
     painter.setRenderHint(QPainter::Antialiasing);
     painter.setWindow(m_projectionRect);
+    if (!m_fullRepaint) {
+        painter.setClipRegion(m_damage);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.fillRect(m_damage.boundingRect(), clearColor());
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    }
 
     RenderingVisitor(&painter).visitChildren(rootNode());
+
+    m_fullRepaint = false;
 }
 
 RenderContext::RenderContext(QSGContext *ctx)
@@ -184,7 +367,8 @@ QSGImageNode *Context::createImageNode()
 
 QSGPainterNode *Context::createPainterNode(QQuickPaintedItem *item)
 {
-    return new PainterNode(item);
+    QSGRenderContext *renderContext = QQuickItemPrivate::get(item)->sceneGraphRenderContext();
+    return new PainterNode(item, static_cast<RenderContext *>(renderContext));
 }
 
 QSGGlyphNode *Context::createGlyphNode(QSGRenderContext *rc, bool preferNativeGlyphNode)
@@ -34,6 +34,11 @@
 #include <private/qsgrenderer_p.h>
 #include <private/qsgadaptationlayer_p.h>
 #include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
 #include <QtGui/QOpenGLShaderProgram>
 #include <QtGui/QBackingStore>
 
@@ -45,6 +50,9 @@ Q_DECLARE_LOGGING_CATEGORY(QSG_RASTER_LOG_TIME_RENDERER)
 Q_DECLARE_LOGGING_CATEGORY(QSG_RASTER_LOG_INFO)
 Q_DECLARE_LOGGING_CATEGORY(QSG_RASTER_LOG_RENDERLOOP)
 
+class PainterNode;
+class RectangleNode;
+
 namespace SoftwareContext
 {
 
@@ -61,9 +69,21 @@ public:
 
     QBackingStore *backingStore() const { return m_backingStore.data(); }
 
+    // The window contents need repainting regardless of scene changes, after
+    // an expose for instance
+    void markFullRepaint() { m_fullRepaint = true; }
+
 private:
+    QRegion damagedRegion() const;
+
     QScopedPointer<QBackingStore> m_backingStore;
-    QRect m_dirtyRect;
+    // Frames where only painted items repainted part of their content only
+    // repaint and flush those parts of the window
+    bool m_fullRepaint;
+    QColor m_previousClearColor;
+    qreal m_previousDevicePixelRatio;
+    QSet<PainterNode *> m_damagedPainterNodes;
+    QSet<RectangleNode *> m_movedRectangleNodes;
 };
 
 class PixmapRenderer : public QSGRenderer
@@ -75,9 +95,36 @@ public:
 
     void render() override;
 
+    void nodeChanged(QSGNode *node, QSGNode::DirtyState state) override;
+
+    // Only the parts of the target covered by changed nodes, where they were
+    // and where they are, are cleared and rendered again. Targets that lost
+    // their contents need a full repaint.
     void render(QPixmap *target);
+    void markFullRepaint() { m_fullRepaint = true; }
 
     QRect m_projectionRect;
+
+private:
+    void collectBounds(QSGNode *node, const QTransform &transform, bool dirty,
+                       QHash<QSGNode *, QRect> *bounds, QHash<QSGNode *, qint64> *layerKeys);
+
+    bool m_fullRepaint;
+    QRect m_previousProjectionRect;
+    QSet<QSGNode *> m_dirtyNodes;
+    QHash<QSGNode *, QRect> m_previousBounds;
+    // Contents of the layers shown by image nodes when last rendered
+    QHash<QSGNode *, qint64> m_previousLayerKeys;
+    QRegion m_damage;
+};
+
+// Painted items declaring a thread safe paint() are painted on this pool
+// during sync, each render context owning its own
+struct PainterJobs
+{
+    QMutex mutex;
+    QVector<PainterNode *> nodes;
+    QThreadPool pool;
 };
 
 class RenderContext : public QSGRenderContext
@@ -93,6 +140,7 @@ public:
 
     QWindow *currentWindow;
     bool m_initialized;
+    PainterJobs painterJobs;
 };
 
 class Context : public QSGContext
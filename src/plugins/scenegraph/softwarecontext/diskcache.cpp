@@ -0,0 +1,331 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "diskcache.h"
+#include "context.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QSaveFile>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+
+#include <string.h>
+
+namespace SoftwareContext {
+
+// Bump the version whenever the layout below or the contents of the keys change
+static const quint32 qsg_disk_cache_magic = 0x52475351;
+static const quint32 qsg_disk_cache_version = 1;
+static const qint64 qsg_disk_cache_limit = 16 * 1024 * 1024;
+static const int qsg_disk_cache_write_delay = 2000;
+
+struct FileHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    quint32 reserved;
+};
+
+// Followed by the key and the image data, each padded to four bytes
+struct EntryHeader
+{
+    quint32 keySize;
+    quint32 dataSize;
+    quint32 bytesPerLine;
+    quint32 checksum;
+    qint32 format;
+    qint16 width;
+    qint16 height;
+    qint16 offsetX;
+    qint16 offsetY;
+};
+
+static inline qint64 padded(qint64 size)
+{
+    return (size + 3) & ~qint64(3);
+}
+
+static inline quint32 checksum(const char *key, uint keySize, const char *data, uint dataSize)
+{
+    return quint32(qChecksum(key, keySize)) | quint32(qChecksum(data, dataSize)) << 16;
+}
+
+static inline bool isStorable(QImage::Format format)
+{
+    return format == QImage::Format_Alpha8 || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+struct DiskCacheEntry
+{
+    QImage image;
+    QPoint offset;
+};
+
+typedef QHash<QByteArray, DiskCacheEntry> DiskCacheEntries;
+
+struct DiskCacheData
+{
+    DiskCacheData() : loaded(false), enabled(false), writeScheduled(false), shuttingDown(false), bytes(0)
+    {
+        writer.setMaxThreadCount(1);
+    }
+
+    ~DiskCacheData()
+    {
+        //Let a pending write go ahead right away
+        QMutexLocker lock(&mutex);
+        shuttingDown = true;
+        wake.wakeAll();
+    }
+
+    QMutex mutex;
+    QWaitCondition wake;
+    bool loaded;
+    bool enabled;
+    bool writeScheduled;
+    bool shuttingDown;
+    QString fileName;
+    // Stays open, loaded entries point into its mapping
+    QFile file;
+    DiskCacheEntries entries;
+    qint64 bytes;
+
+    // Last, so that it waits for the writer before anything else goes away
+    QThreadPool writer;
+};
+
+Q_GLOBAL_STATIC(DiskCacheData, qsg_disk_cache)
+
+// The cache file stays mapped while the process runs, and a mapped file
+// cannot be replaced on every platform, so new contents are written next to
+// it and take its place on the next load
+static QString pendingFileName(const QString &fileName)
+{
+    return fileName + QLatin1String(".new");
+}
+
+static bool writeCacheFile(const QString &fileName, const DiskCacheEntries &entries)
+{
+    QSaveFile file(pendingFileName(fileName));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(QSG_RASTER_LOG_INFO) << "could not open" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    const FileHeader header = { qsg_disk_cache_magic, qsg_disk_cache_version, quint32(entries.size()), 0 };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    static const char padding[4] = { 0, 0, 0, 0 };
+    for (DiskCacheEntries::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QByteArray &key = it.key();
+        const QImage &image = it->image;
+        const int lineSize = image.width() * image.depth() / 8;
+
+        EntryHeader entry;
+        entry.keySize = key.size();
+        entry.bytesPerLine = quint32(padded(lineSize));
+        entry.dataSize = entry.bytesPerLine * image.height();
+        entry.format = image.isNull() ? QImage::Format_Alpha8 : image.format();
+        entry.width = image.width();
+        entry.height = image.height();
+        entry.offsetX = it->offset.x();
+        entry.offsetY = it->offset.y();
+
+        QByteArray data(entry.dataSize, 0);
+        for (int y = 0; y < image.height(); ++y)
+            memcpy(data.data() + y * entry.bytesPerLine, image.constScanLine(y), lineSize);
+        entry.checksum = checksum(key.constData(), key.size(), data.constData(), data.size());
+
+        file.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        file.write(key);
+        file.write(padding, padded(entry.keySize) - entry.keySize);
+        file.write(data);
+    }
+    if (!file.commit()) {
+        qCWarning(QSG_RASTER_LOG_INFO) << "could not save" << file.fileName() << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+class DiskCacheWriter : public QRunnable
+{
+public:
+    explicit DiskCacheWriter(DiskCacheData *d) : m_d(d) {}
+
+    void run() override
+    {
+        //Collect the entries of a burst of inserts into one write
+        DiskCacheEntries entries;
+        QString fileName;
+        {
+            QMutexLocker lock(&m_d->mutex);
+            if (!m_d->shuttingDown)
+                m_d->wake.wait(&m_d->mutex, qsg_disk_cache_write_delay);
+            m_d->writeScheduled = false;
+            entries = m_d->entries;
+            fileName = m_d->fileName;
+        }
+
+        if (writeCacheFile(fileName, entries))
+            qCDebug(QSG_RASTER_LOG_INFO) << "wrote" << entries.size() << "entries to" << pendingFileName(fileName);
+    }
+
+private:
+    DiskCacheData *m_d;
+};
+
+void DiskCache::load()
+{
+    DiskCacheData *d = qsg_disk_cache();
+    QMutexLocker lock(&d->mutex);
+    if (d->loaded)
+        return;
+    d->loaded = true;
+
+    d->fileName = QFile::decodeName(qgetenv("QSG_RASTER_DISK_CACHE"));
+    d->enabled = !d->fileName.isEmpty();
+    if (!d->enabled)
+        return;
+
+    //Nothing maps the cache file yet, so the last written contents can replace it
+    const QString pending = pendingFileName(d->fileName);
+    if (QFile::exists(pending)) {
+        QFile::remove(d->fileName);
+        if (!QFile::rename(pending, d->fileName))
+            qCWarning(QSG_RASTER_LOG_INFO) << "could not replace" << d->fileName << "with" << pending;
+    }
+
+    d->file.setFileName(d->fileName);
+    if (!d->file.open(QIODevice::ReadOnly))
+        return;
+
+    const qint64 size = d->file.size();
+    const uchar *data = size >= qint64(sizeof(FileHeader)) ? d->file.map(0, size) : 0;
+    const FileHeader *header = reinterpret_cast<const FileHeader *>(data);
+    if (!header || header->magic != qsg_disk_cache_magic || header->version != qsg_disk_cache_version) {
+        qCDebug(QSG_RASTER_LOG_INFO) << "ignoring incompatible disk cache" << d->fileName;
+        d->file.close();
+        return;
+    }
+
+    qint64 pos = sizeof(FileHeader);
+    for (quint32 i = 0; i < header->count; ++i) {
+        if (pos + qint64(sizeof(EntryHeader)) > size)
+            break;
+        const EntryHeader *entry = reinterpret_cast<const EntryHeader *>(data + pos);
+
+        //Sizes are checked against what is left of the file before anything
+        //is read, a truncated or corrupt file drops the rest of the entries
+        const qint64 keyPos = pos + sizeof(EntryHeader);
+        if (qint64(entry->keySize) > size - keyPos)
+            break;
+        const qint64 dataPos = keyPos + padded(entry->keySize);
+        if (dataPos > size || qint64(entry->dataSize) > size - dataPos)
+            break;
+        pos = qMin(dataPos + padded(entry->dataSize), size);
+
+        const char *key = reinterpret_cast<const char *>(data + keyPos);
+        const char *bits = reinterpret_cast<const char *>(data + dataPos);
+        const QImage::Format format = QImage::Format(entry->format);
+        if (!isStorable(format) || entry->width < 0 || entry->height < 0
+                || qint64(entry->bytesPerLine) < qint64(entry->width) * (format == QImage::Format_Alpha8 ? 1 : 4)
+                || qint64(entry->dataSize) != qint64(entry->bytesPerLine) * entry->height
+                || entry->checksum != checksum(key, entry->keySize, bits, entry->dataSize))
+            continue;
+
+        //Loaded images are read only views into the mapping
+        DiskCacheEntry cached;
+        if (entry->width > 0 && entry->height > 0)
+            cached.image = QImage(data + dataPos, entry->width, entry->height, entry->bytesPerLine, format);
+        cached.offset = QPoint(entry->offsetX, entry->offsetY);
+        d->entries.insert(QByteArray(key, entry->keySize), cached);
+        d->bytes += entry->dataSize;
+    }
+
+    qCDebug(QSG_RASTER_LOG_INFO) << "loaded" << d->entries.size() << "entries from" << d->fileName;
+}
+
+bool DiskCache::isEnabled()
+{
+    DiskCacheData *d = qsg_disk_cache();
+    if (!d)
+        return false;
+    QMutexLocker lock(&d->mutex);
+    return d->enabled;
+}
+
+bool DiskCache::find(const QByteArray &key, QImage *image, QPoint *offset)
+{
+    DiskCacheData *d = qsg_disk_cache();
+    if (!d)
+        return false;
+
+    QMutexLocker lock(&d->mutex);
+    const DiskCacheEntries::const_iterator it = d->entries.constFind(key);
+    if (it == d->entries.constEnd())
+        return false;
+
+    *image = it->image;
+    if (offset)
+        *offset = it->offset;
+    return true;
+}
+
+void DiskCache::insert(const QByteArray &key, const QImage &image, const QPoint &offset)
+{
+    if (!image.isNull() && (!isStorable(image.format()) || image.width() > 0x7fff || image.height() > 0x7fff))
+        return;
+
+    DiskCacheData *d = qsg_disk_cache();
+    if (!d)
+        return;
+
+    QMutexLocker lock(&d->mutex);
+    if (!d->enabled || d->shuttingDown || d->entries.contains(key) || d->bytes + image.byteCount() > qsg_disk_cache_limit)
+        return;
+
+    DiskCacheEntry entry;
+    entry.image = image;
+    entry.offset = offset;
+    d->entries.insert(key, entry);
+    d->bytes += image.byteCount();
+
+    if (!d->writeScheduled) {
+        d->writeScheduled = true;
+        d->writer.start(new DiskCacheWriter(d));
+    }
+}
+
+} // namespace
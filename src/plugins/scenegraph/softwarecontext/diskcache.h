@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QtGui/QImage>
+
+namespace SoftwareContext {
+
+// Glyph masks and corner pixmaps kept across runs to shorten the time to the
+// first frame. Enabled by setting QSG_RASTER_DISK_CACHE to a file name. The
+// file is memory mapped when loaded. New entries are written in the background
+// to a file with a ".new" suffix, which replaces the cache file on the next
+// load. Only Alpha8 and ARGB32_Premultiplied images are stored.
+class DiskCache
+{
+public:
+    static void load();
+    static bool isEnabled();
+
+    static bool find(const QByteArray &key, QImage *image, QPoint *offset = 0);
+    static void insert(const QByteArray &key, const QImage &image, const QPoint &offset = QPoint());
+};
+
+} // namespace
+
+#endif // DISKCACHE_H
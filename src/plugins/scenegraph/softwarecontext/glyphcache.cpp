@@ -0,0 +1,454 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "glyphcache.h"
+#include "diskcache.h"
+#include "spanfiller.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCache>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVarLengthArray>
+#include <QtGui/private/qfontengine_p.h>
+#include <QtGui/private/qrawfont_p.h>
+#include <qmath.h>
+
+namespace SoftwareContext {
+
+struct GlyphMaskKey
+{
+    int font;
+    glyph_t glyph;
+    int subPixelPosition;
+};
+
+static inline bool operator==(const GlyphMaskKey &a, const GlyphMaskKey &b)
+{
+    return a.font == b.font && a.glyph == b.glyph && a.subPixelPosition == b.subPixelPosition;
+}
+
+static inline uint qHash(const GlyphMaskKey &key, uint seed = 0)
+{
+    return ::qHash(key.glyph, seed) ^ uint(key.font << 16) ^ uint(key.subPixelPosition);
+}
+
+struct GlyphMask
+{
+    QImage image;
+    QPoint offset;
+};
+
+// Font identity of an engine, checked against the engine's description so
+// that an engine allocated at the address of a deleted one is not mistaken
+// for it
+struct EngineFont
+{
+    QFontDef fontDef;
+    QFontEngine::FaceId faceId;
+    int id;
+};
+
+struct QueuedGlyph
+{
+    glyph_t glyph;
+    QFixed subPixelPosition;
+};
+
+// Masks are evicted least recently used first. Font engines come and go with
+// the font cache, so fonts are identified by their description rather than by
+// engine pointer.
+//
+// Font engines are not thread safe, and engines of the same font share their
+// face, so prewarm jobs never touch the engine text is laid out and painted
+// with, nor a clone of it. They load the font file again on the worker into a
+// raw font of their own, which gets an engine and a face nobody else uses.
+// Each font has at most one job.
+struct GlyphMaskCache
+{
+    GlyphMaskCache() : masks(2 * 1024 * 1024) {}
+
+    int fontId(const QRawFont &font, QFontEngine *engine);
+
+    QMutex mutex;
+    QHash<QByteArray, int> fonts;
+    QHash<QFontEngine *, EngineFont> engines;
+    QHash<int, QByteArray> diskFontKeys;
+    QCache<GlyphMaskKey, GlyphMask> masks;
+
+    QHash<int, QVector<QueuedGlyph> > queued;
+    QSet<int> runningJobs;
+    // Fonts whose file does not load into an equivalent engine are not prewarmed
+    QSet<int> unloadableFonts;
+
+    // Last, so that it waits for the jobs before anything else goes away
+    QThreadPool pool;
+};
+
+Q_GLOBAL_STATIC(GlyphMaskCache, qsg_glyph_mask_cache)
+
+// Kept apart from the cache, so that reading it takes no lock and does not
+// create the cache in scenes without text
+static QAtomicInt qsg_glyph_cache_misses;
+
+static QByteArray fontIdentity(const QRawFont &font, QFontEngine *engine)
+{
+    const QFontEngine::FaceId faceId = engine->faceId();
+    QByteArray identity = faceId.filename;
+    identity += ':' + QByteArray::number(faceId.index) + ':' + faceId.uuid;
+    identity += ':' + font.familyName().toUtf8() + ':' + font.styleName().toUtf8();
+    identity += ':' + QByteArray::number(font.pixelSize());
+    identity += ':' + QByteArray::number(engine->fontDef.weight) + ':' + QByteArray::number(engine->fontDef.style);
+    identity += ':' + QByteArray::number(int(font.hintingPreference())) + ':' + QByteArray::number(int(engine->type()));
+    return identity;
+}
+
+// Masks on disk outlive the process, so the font file is identified by its
+// size and modification time on top of its name. Fonts that do not come from
+// a file are not stored.
+static QByteArray diskFontKey(const QByteArray &identity, QFontEngine *engine)
+{
+    if (!DiskCache::isEnabled())
+        return QByteArray();
+
+    const QFileInfo info(QFile::decodeName(engine->faceId().filename));
+    if (!info.isFile())
+        return QByteArray();
+
+    const QByteArray key = identity + ':' + QByteArray::number(info.size())
+            + ':' + QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+    return "glyph:" + QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+}
+
+// Font engines hand out coverage as Alpha8, or as Indexed8 with the coverage
+// stored in the indices, or as 1 bit masks for unantialiased fonts.
+static QImage coverageMask(const QImage &image)
+{
+    switch (image.format()) {
+    case QImage::Format_Alpha8:
+        return image;
+    case QImage::Format_Indexed8:
+    case QImage::Format_Grayscale8: {
+        QImage mask(image.size(), QImage::Format_Alpha8);
+        for (int y = 0; y < image.height(); ++y)
+            memcpy(mask.scanLine(y), image.constScanLine(y), image.width());
+        return mask;
+    }
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB: {
+        QImage mask(image.size(), QImage::Format_Alpha8);
+        for (int y = 0; y < image.height(); ++y) {
+            uchar *line = mask.scanLine(y);
+            for (int x = 0; x < image.width(); ++x)
+                line[x] = image.pixelIndex(x, y) ? 255 : 0;
+        }
+        return mask;
+    }
+    default:
+        return QImage();
+    }
+}
+
+int GlyphMaskCache::fontId(const QRawFont &font, QFontEngine *engine)
+{
+    //Engines come and go, the identity string is only built the first time
+    //an engine is seen
+    static const int maximumEngines = 256;
+
+    QHash<QFontEngine *, EngineFont>::const_iterator known = engines.constFind(engine);
+    if (known != engines.constEnd() && known->fontDef == engine->fontDef && known->faceId == engine->faceId())
+        return known->id;
+
+    const QByteArray identity = fontIdentity(font, engine);
+    QHash<QByteArray, int>::const_iterator it = fonts.constFind(identity);
+    if (it == fonts.constEnd()) {
+        it = fonts.insert(identity, fonts.size());
+        diskFontKeys.insert(it.value(), diskFontKey(identity, engine));
+    }
+
+    if (engines.size() >= maximumEngines)
+        engines.clear();
+    const EngineFont engineFont = { engine->fontDef, engine->faceId(), it.value() };
+    engines.insert(engine, engineFont);
+    return it.value();
+}
+
+// Returns 0 if the engine has no coverage mask for a visible glyph
+static GlyphMask *createMask(QFontEngine *engine, glyph_t glyph, QFixed subPixelPosition, const QByteArray &fontKey)
+{
+    QByteArray diskKey;
+    if (!fontKey.isEmpty()) {
+        diskKey = fontKey + ':' + QByteArray::number(glyph) + ':' + QByteArray::number(subPixelPosition.value());
+        QImage image;
+        QPoint offset;
+        if (DiskCache::find(diskKey, &image, &offset)) {
+            GlyphMask *mask = new GlyphMask;
+            mask->image = image;
+            mask->offset = offset;
+            return mask;
+        }
+    }
+
+    //Masks are placed the way the raster engine places them: engines with
+    //their own glyph cache report the offset, the others are positioned
+    //like QImageTextureGlyphCache entries
+    const QFontEngine::GlyphFormat format = engine->glyphFormat != QFontEngine::Format_None
+            ? engine->glyphFormat : QFontEngine::Format_A8;
+    QImage image;
+    QPoint offset;
+    bool visible = true;
+    if (engine->hasInternalCaching()) {
+        if (QImage *alphaMap = engine->lockedAlphaMapForGlyph(glyph, subPixelPosition, format, QTransform(), &offset)) {
+            image = coverageMask(*alphaMap);
+            //Locked maps point into the engine's own glyph data
+            if (!image.isNull() && image.constBits() == alphaMap->constBits())
+                image = image.copy();
+            visible = !alphaMap->isNull();
+        }
+        engine->unlockAlphaMapForGlyph();
+    } else {
+        const glyph_metrics_t metrics = engine->alphaMapBoundingBox(glyph, subPixelPosition, QTransform(), format);
+        image = coverageMask(engine->alphaMapForGlyph(glyph, subPixelPosition));
+        offset = QPoint(metrics.x.truncate(), metrics.y.truncate());
+        visible = metrics.width > 0 && metrics.height > 0;
+    }
+    if (image.isNull() && visible)
+        return 0;
+
+    GlyphMask *mask = new GlyphMask;
+    mask->image = image;
+    mask->offset = offset;
+    if (!diskKey.isEmpty())
+        DiskCache::insert(diskKey, mask->image, mask->offset);
+    return mask;
+}
+
+static QFontEngine *maskableEngine(const QRawFont &font)
+{
+    //Color and subpixel antialiased glyphs are left to QPainter
+    QFontEngine *engine = font.isValid() ? QRawFontPrivate::get(font)->fontEngine : 0;
+    if (!engine || engine->glyphFormat == QFontEngine::Format_ARGB || engine->glyphFormat == QFontEngine::Format_A32
+            || engine->synthesized())
+        return 0;
+    return engine;
+}
+
+class GlyphPrewarmJob : public QRunnable
+{
+public:
+    GlyphPrewarmJob(GlyphMaskCache *cache, int font, const QRawFont &rawFont, QFontEngine *engine)
+        : m_cache(cache)
+        , m_font(font)
+        , m_fileName(QFile::decodeName(engine->faceId().filename))
+        , m_pixelSize(rawFont.pixelSize())
+        , m_hintingPreference(rawFont.hintingPreference())
+        , m_type(engine->type())
+        , m_glyphFormat(engine->glyphFormat)
+        , m_diskFontKey(cache->diskFontKeys.value(font))
+    {
+    }
+
+    void run() override
+    {
+        //The raw font and its engine are created, used and destroyed on this
+        //thread only
+        QRawFont rawFont;
+        QFile file(m_fileName);
+        if (file.open(QIODevice::ReadOnly))
+            rawFont.loadFromData(file.readAll(), m_pixelSize, m_hintingPreference);
+        file.close();
+
+        //Masks of an engine set up differently would not match the painted ones
+        QFontEngine *engine = maskableEngine(rawFont);
+        if (engine && (engine->type() != m_type || engine->glyphFormat != m_glyphFormat))
+            engine = 0;
+
+        QMutexLocker lock(&m_cache->mutex);
+        if (!engine)
+            m_cache->unloadableFonts.insert(m_font);
+        forever {
+            const QVector<QueuedGlyph> glyphs = m_cache->queued.take(m_font);
+            if (glyphs.isEmpty() || !engine)
+                break;
+
+            lock.unlock();
+            QVector<GlyphMask *> masks(glyphs.size());
+            for (int i = 0; i < glyphs.size(); ++i)
+                masks[i] = createMask(engine, glyphs.at(i).glyph, glyphs.at(i).subPixelPosition, m_diskFontKey);
+            lock.relock();
+
+            for (int i = 0; i < glyphs.size(); ++i) {
+                if (!masks.at(i))
+                    continue;
+                const GlyphMaskKey key = { m_font, glyphs.at(i).glyph, glyphs.at(i).subPixelPosition.value() };
+                m_cache->masks.insert(key, masks.at(i), qMax(1, masks.at(i)->image.byteCount()));
+            }
+        }
+        m_cache->runningJobs.remove(m_font);
+    }
+
+private:
+    GlyphMaskCache *m_cache;
+    int m_font;
+    QString m_fileName;
+    qreal m_pixelSize;
+    QFont::HintingPreference m_hintingPreference;
+    QFontEngine::Type m_type;
+    QFontEngine::GlyphFormat m_glyphFormat;
+    QByteArray m_diskFontKey;
+};
+
+void prewarmGlyphRun(const QPointF &pos, const QGlyphRun &glyphRun)
+{
+    const QRawFont font = glyphRun.rawFont();
+    QFontEngine *engine = maskableEngine(font);
+    if (!engine)
+        return;
+
+    const QVector<quint32> glyphs = glyphRun.glyphIndexes();
+    const QVector<QPointF> positions = glyphRun.positions();
+    const int count = qMin(glyphs.size(), positions.size());
+
+    //Only fonts loaded whole from a file can be loaded again on the worker
+    const QFontEngine::FaceId faceId = engine->faceId();
+    if (faceId.filename.isEmpty() || faceId.index != 0)
+        return;
+
+    GlyphMaskCache *cache = qsg_glyph_mask_cache();
+    QMutexLocker lock(&cache->mutex);
+
+    const int fontId = cache->fontId(font, engine);
+    if (cache->unloadableFonts.contains(fontId))
+        return;
+    QVector<QueuedGlyph> &queued = cache->queued[fontId];
+    QSet<GlyphMaskKey> seen;
+
+    // Nodes are usually placed at whole pixels, so the local sub pixel
+    // position is the one the glyph will be painted at
+    for (int i = 0; i < count; ++i) {
+        const QFixed subPixelPosition = engine->subPixelPositionForX(QFixed::fromReal(pos.x() + positions.at(i).x()));
+        const GlyphMaskKey key = { fontId, glyphs.at(i), subPixelPosition.value() };
+        if (cache->masks.contains(key) || seen.contains(key))
+            continue;
+        seen.insert(key);
+        const QueuedGlyph glyph = { glyphs.at(i), subPixelPosition };
+        queued.append(glyph);
+    }
+
+    if (queued.isEmpty()) {
+        cache->queued.remove(fontId);
+        return;
+    }
+
+    if (!cache->runningJobs.contains(fontId)) {
+        cache->runningJobs.insert(fontId);
+        cache->pool.start(new GlyphPrewarmJob(cache, fontId, font, engine));
+    }
+}
+
+int takeGlyphCacheMisses()
+{
+    return qsg_glyph_cache_misses.fetchAndStoreRelaxed(0);
+}
+
+bool drawGlyphRunMasks(const DirectTarget &target, const QPointF &pos, const QGlyphRun &glyphRun, QRgb color)
+{
+    if (glyphRun.overline() || glyphRun.underline() || glyphRun.strikeOut())
+        return false;
+
+    const QRawFont font = glyphRun.rawFont();
+    QFontEngine *engine = maskableEngine(font);
+    if (!engine)
+        return false;
+
+    const QVector<quint32> glyphs = glyphRun.glyphIndexes();
+    const QVector<QPointF> positions = glyphRun.positions();
+    const int count = qMin(glyphs.size(), positions.size());
+
+    struct PlacedMask
+    {
+        QImage image;
+        QPoint pos;
+    };
+    QVarLengthArray<PlacedMask, 64> placed;
+    placed.reserve(count);
+
+    // Look up or rasterize all masks under a single lock, blend them after
+    {
+        GlyphMaskCache *cache = qsg_glyph_mask_cache();
+        QMutexLocker lock(&cache->mutex);
+
+        //Masks still missing are rasterized here even if a prewarm job is
+        //about to deliver them, the job's copies replace these
+        const int fontId = cache->fontId(font, engine);
+
+        for (int i = 0; i < count; ++i) {
+            // Positions are snapped like the raster engine does
+            const QPointF devicePos = pos + positions.at(i) + target.offset;
+            const QFixed subPixelPosition = engine->subPixelPositionForX(QFixed::fromReal(devicePos.x()));
+            const GlyphMaskKey key = { fontId, glyphs.at(i), subPixelPosition.value() };
+
+            GlyphMask *mask = cache->masks.object(key);
+            QImage image;
+            QPoint offset;
+            if (mask) {
+                image = mask->image;
+                offset = mask->offset;
+            } else {
+                qsg_glyph_cache_misses.ref();
+                mask = createMask(engine, glyphs.at(i), subPixelPosition, cache->diskFontKeys.value(fontId));
+                if (!mask)
+                    return false;
+                //The cache deletes masks bigger than itself right away
+                image = mask->image;
+                offset = mask->offset;
+                cache->masks.insert(key, mask, qMax(1, mask->image.byteCount()));
+            }
+            if (image.isNull())
+                continue;
+
+            const PlacedMask p = { image, QPoint(qFloor(devicePos.x()), qRound(devicePos.y())) + offset - target.offset };
+            placed.append(p);
+        }
+    }
+
+    for (int i = 0; i < placed.size(); ++i)
+        blendMask(target, placed.at(i).pos, placed.at(i).image, color);
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <QtGui/QGlyphRun>
+#include <QtGui/qrgb.h>
+
+namespace SoftwareContext {
+
+struct DirectTarget;
+
+// Draws a glyph run by blending 8 bit coverage masks from a process wide
+// cache shared by all glyph nodes. Returns false without drawing anything if
+// the run's font or decorations cannot be drawn that way.
+bool drawGlyphRunMasks(const DirectTarget &target, const QPointF &pos, const QGlyphRun &glyphRun, QRgb color);
+
+// Starts rasterizing the masks a glyph run is missing on a worker thread, so
+// that they are ready by the time the run is painted.
+void prewarmGlyphRun(const QPointF &pos, const QGlyphRun &glyphRun);
+
+// Number of masks rasterized while painting since the last call.
+int takeGlyphCacheMisses();
+
+} // namespace
+
+#endif // GLYPHCACHE_H
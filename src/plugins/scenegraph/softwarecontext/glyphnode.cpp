@@ -28,10 +28,72 @@
 ****************************************************************************/
 
 #include "glyphnode.h"
+#include "glyphcache.h"
+#include "spanfiller.h"
+
+#include <qmath.h>
+
+#include <string.h>
+
+//Outline is the coverage dilated by one pixel in each direction, raised and
+//sunken text the coverage shifted one pixel down or up
+static QImage styleMask(const QImage &coverage, QQuickText::TextStyle style)
+{
+    const int width = coverage.width();
+    const int height = coverage.height();
+    QImage mask(coverage.size(), QImage::Format_Alpha8);
+    mask.fill(0);
+
+    for (int y = 0; y < height; ++y) {
+        uchar *dst = mask.scanLine(y);
+        const uchar *above = y > 0 ? coverage.constScanLine(y - 1) : 0;
+        const uchar *below = y + 1 < height ? coverage.constScanLine(y + 1) : 0;
+
+        if (style == QQuickText::Raised) {
+            if (above)
+                memcpy(dst, above, width);
+        } else if (style == QQuickText::Sunken) {
+            if (below)
+                memcpy(dst, below, width);
+        } else if (style == QQuickText::Outline) {
+            const uchar *line = coverage.constScanLine(y);
+            for (int x = 1; x < width - 1; ++x)
+                dst[x] = qMax(line[x - 1], line[x + 1]);
+            if (width > 1) {
+                dst[0] = line[1];
+                dst[width - 1] = line[width - 2];
+            }
+            if (above) {
+                for (int x = 0; x < width; ++x)
+                    dst[x] = qMax(dst[x], above[x]);
+            }
+            if (below) {
+                for (int x = 0; x < width; ++x)
+                    dst[x] = qMax(dst[x], below[x]);
+            }
+        }
+    }
+    return mask;
+}
+
+//The run's bounding rect is the logical box of the text, glyphs reach out of
+//it with overhangs, italics and deep descenders
+static QRectF glyphRunBounds(const QGlyphRun &glyphRun)
+{
+    const QRawFont font = glyphRun.rawFont();
+    const QVector<quint32> indexes = glyphRun.glyphIndexes();
+    const QVector<QPointF> positions = glyphRun.positions();
+
+    QRectF bounds = glyphRun.boundingRect();
+    for (int i = 0; i < qMin(indexes.size(), positions.size()); ++i)
+        bounds |= font.boundingRect(indexes.at(i)).translated(positions.at(i));
+    return bounds;
+}
 
 GlyphNode::GlyphNode()
     : m_geometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 0)
     , m_style(QQuickText::Normal)
+    , m_cacheIsDirty(true)
 {
     setMaterial((QSGMaterial*)1);
     setGeometry(&m_geometry);
@@ -42,21 +104,26 @@ void GlyphNode::setGlyphs(const QPointF &position, const QGlyphRun &glyphs)
 {
     m_position = position;
     m_glyphRun = glyphs;
+    m_glyphBounds = glyphRunBounds(glyphs);
+    invalidateCache();
 }
 
 void GlyphNode::setColor(const QColor &color)
 {
     m_color = color;
+    invalidateCache();
 }
 
 void GlyphNode::setStyle(QQuickText::TextStyle style)
 {
     m_style = style;
+    invalidateCache();
 }
 
 void GlyphNode::setStyleColor(const QColor &color)
 {
     m_styleColor = color;
+    invalidateCache();
 }
 
 QPointF GlyphNode::baseLine() const
@@ -70,13 +137,38 @@ void GlyphNode::setPreferredAntialiasingMode(QSGGlyphNode::AntialiasingMode)
 
 void GlyphNode::update()
 {
+    //Plain text is drawn from the shared glyph masks, get the missing ones
+    //rasterized before the paint pass needs them
+    if (m_style == QQuickText::Normal)
+        SoftwareContext::prewarmGlyphRun(m_position - QPointF(0, m_glyphRun.rawFont().ascent()), m_glyphRun);
 }
 
-void GlyphNode::paint(QPainter *painter)
+void GlyphNode::paint(QPainter *painter, const SoftwareContext::DirectClip &clip)
 {
     painter->setBrush(QBrush());
     QPointF pos = m_position - QPointF(0, m_glyphRun.rawFont().ascent());
 
+    //Plain text is blended from the shared glyph masks, styled text from the
+    //node's cached raster of the run and its style
+    SoftwareContext::DirectTarget target;
+    if (m_style == QQuickText::Normal
+            && SoftwareContext::directTarget(painter, clip, boundingRect().toAlignedRect(), &target)
+            && SoftwareContext::drawGlyphRunMasks(target, pos, m_glyphRun, qPremultiply(m_color.rgba())))
+        return;
+
+    if (!paintCached(painter, pos))
+        paintGlyphRun(painter, pos);
+}
+
+QRectF GlyphNode::boundingRect() const
+{
+    //Leave room for the style passes
+    const QPointF pos = m_position - QPointF(0, m_glyphRun.rawFont().ascent());
+    return m_glyphBounds.translated(pos).adjusted(-1, -1, 1, 1);
+}
+
+void GlyphNode::paintGlyphRun(QPainter *painter, const QPointF &pos)
+{
     switch (m_style) {
     case QQuickText::Normal: break;
     case QQuickText::Outline:
@@ -99,3 +191,64 @@ void GlyphNode::paint(QPainter *painter)
     painter->setPen(m_color);
     painter->drawGlyphRun(pos, m_glyphRun);
 }
+
+bool GlyphNode::paintCached(QPainter *painter, const QPointF &pos)
+{
+    //Runs bigger than this are drawn directly rather than cached
+    static const int maximumCachedArea = 512 * 512;
+
+    if (painter->transform().type() > QTransform::TxTranslate || painter->device()->devicePixelRatio() != 1)
+        return false;
+
+    //Glyph rasterization depends on the sub pixel position, so the cache is
+    //only valid for the fractional offset it was rendered at
+    const QPointF devicePos = pos + QPointF(painter->transform().dx(), painter->transform().dy());
+    const QPoint base(qFloor(devicePos.x()), qFloor(devicePos.y()));
+    const QPointF subPixelOffset = devicePos - base;
+
+    if (m_cacheIsDirty || m_cacheSubPixelOffset != subPixelOffset) {
+        m_cache.clear();
+        m_cacheIsDirty = false;
+        m_cacheSubPixelOffset = subPixelOffset;
+
+        //Leave room for the style passes and anti-aliasing
+        const QRect area = m_glyphBounds.translated(subPixelOffset).adjusted(-2, -2, 2, 2).toAlignedRect();
+        if (area.isEmpty() || area.width() * area.height() > maximumCachedArea
+                || !SoftwareContext::CachedPixmap::fitsBudget(area.size()))
+            return false;
+
+        //Rasterize the coverage once and derive the style pass from it
+        QImage image(area.size(), QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter imagePainter(&image);
+        imagePainter.setRenderHints(painter->renderHints());
+        imagePainter.translate(-area.topLeft());
+        imagePainter.setPen(Qt::black);
+        imagePainter.drawGlyphRun(subPixelOffset, m_glyphRun);
+        imagePainter.end();
+
+        const QImage coverage = image.convertToFormat(QImage::Format_Alpha8);
+        image.fill(Qt::transparent);
+        const SoftwareContext::DirectTarget target = { &image, QPoint(), image.rect(), 255 };
+        if (m_style != QQuickText::Normal)
+            SoftwareContext::blendMask(target, QPoint(), styleMask(coverage, m_style), qPremultiply(m_styleColor.rgba()));
+        SoftwareContext::blendMask(target, QPoint(), coverage, qPremultiply(m_color.rgba()));
+
+        if (!m_cache.setPixmap(QPixmap::fromImage(image)))
+            return false;
+        m_cacheOrigin = area.topLeft();
+    }
+
+    if (m_cache.isNull())
+        return false;
+
+    painter->drawPixmap(QPointF(base + m_cacheOrigin) - QPointF(painter->transform().dx(), painter->transform().dy()),
+                        m_cache.pixmap());
+    return true;
+}
+
+void GlyphNode::invalidateCache()
+{
+    m_cacheIsDirty = true;
+    m_cache.clear();
+}
@@ -32,6 +32,9 @@
 
 #include <private/qsgadaptationlayer_p.h>
 
+#include "nodecache.h"
+#include "spanfiller.h"
+
 class GlyphNode : public QSGGlyphNode
 {
 public:
@@ -45,15 +48,26 @@ public:
     void setPreferredAntialiasingMode(AntialiasingMode) override;
     void update() override;
 
-    void paint(QPainter *painter);
+    void paint(QPainter *painter, const SoftwareContext::DirectClip &clip);
+    QRectF boundingRect() const;
 
 private:
+    void paintGlyphRun(QPainter *painter, const QPointF &pos);
+    bool paintCached(QPainter *painter, const QPointF &pos);
+    void invalidateCache();
+
     QPointF m_position;
     QGlyphRun m_glyphRun;
+    QRectF m_glyphBounds;
     QColor m_color;
     QSGGeometry m_geometry;
     QQuickText::TextStyle m_style;
     QColor m_styleColor;
+
+    SoftwareContext::CachedPixmap m_cache;
+    QPointF m_cacheSubPixelOffset;
+    QPoint m_cacheOrigin;
+    bool m_cacheIsDirty;
 };
 
 #endif // GLYPHNODE_H
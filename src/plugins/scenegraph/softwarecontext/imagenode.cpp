@@ -302,14 +302,127 @@ void qDrawBorderPixmap(QPainter *painter, const QRect &targetRect, const QMargin
         painter->setRenderHint(QPainter::Antialiasing, true);
 }
 
+static bool isOpaque(const QImage &image, const QRect &rect)
+{
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (qAlpha(line[x]) != 255)
+                return false;
+        }
+    }
+    return true;
+}
+
+BorderPixmapOpacity::BorderPixmapOpacity()
+    : m_cacheKey(0)
+    , m_hints(0)
+{
+}
+
+QDrawBorderPixmap::DrawingHints BorderPixmapOpacity::hints(const QPixmap &pixmap, const QMargins &sourceMarginsIn)
+{
+    if (m_cacheKey == pixmap.cacheKey() && m_margins == sourceMarginsIn)
+        return m_hints;
+
+    m_cacheKey = pixmap.cacheKey();
+    m_margins = sourceMarginsIn;
+
+    if (!pixmap.hasAlphaChannel()) {
+        m_hints = QDrawBorderPixmap::OpaqueAll;
+        return m_hints;
+    }
+
+    QImage image = pixmap.toImage();
+    if (image.format() != QImage::Format_ARGB32_Premultiplied && image.format() != QImage::Format_ARGB32)
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    const QMargins sourceMargins = normalizedMargins(sourceMarginsIn);
+    const int xs[] = { 0, sourceMargins.left(), image.width() - sourceMargins.right(), image.width() };
+    const int ys[] = { 0, sourceMargins.top(), image.height() - sourceMargins.bottom(), image.height() };
+
+    // The hint flags are ordered row by row, top left to bottom right.
+    m_hints = 0;
+    int hint = QDrawBorderPixmap::OpaqueTopLeft;
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+            const QRect patch(QPoint(xs[column], ys[row]), QPoint(xs[column + 1] - 1, ys[row + 1] - 1));
+            if (isOpaque(image, patch.intersected(image.rect())))
+                m_hints |= QDrawBorderPixmap::DrawingHint(hint);
+            hint <<= 1;
+        }
+    }
+    return m_hints;
+}
+
+BorderPixmapCache::BorderPixmapCache()
+    : m_cacheKey(0)
+    , m_devicePixelRatio(1)
+    , m_horizontalRule(Qt::StretchTile)
+    , m_verticalRule(Qt::StretchTile)
+    , m_smooth(false)
+{
+}
+
+const QPixmap &BorderPixmapCache::pixmap(const QSize &targetSize, int devicePixelRatio, const QMargins &targetMargins,
+                                         const QPixmap &pixmap, const QMargins &sourceMargins,
+                                         const QTileRules &rules, QDrawBorderPixmap::DrawingHints hints, bool smooth)
+{
+    if (!m_pixmap.isNull() && m_cacheKey == pixmap.cacheKey() && m_targetSize == targetSize
+            && m_devicePixelRatio == devicePixelRatio && m_targetMargins == targetMargins
+            && m_sourceMargins == sourceMargins && m_horizontalRule == rules.horizontal
+            && m_verticalRule == rules.vertical && m_smooth == smooth) {
+        return m_pixmap.pixmap();
+    }
+
+    //Targets resized from one frame to the next are drawn uncached until
+    //their size settles
+    const bool resized = m_targetSize != targetSize;
+
+    m_pixmap.clear();
+    m_cacheKey = pixmap.cacheKey();
+    m_targetSize = targetSize;
+    m_devicePixelRatio = devicePixelRatio;
+    m_targetMargins = targetMargins;
+    m_sourceMargins = sourceMargins;
+    m_horizontalRule = rules.horizontal;
+    m_verticalRule = rules.vertical;
+    m_smooth = smooth;
+
+    const QSize deviceSize = targetSize * devicePixelRatio;
+    if (resized || !CachedPixmap::fitsBudget(deviceSize))
+        return m_pixmap.pixmap();
+
+    //Fully opaque borders are composed without alpha, so they keep blitting
+    //without blending
+    QPixmap composed;
+    if ((hints & QDrawBorderPixmap::OpaqueAll) == QDrawBorderPixmap::OpaqueAll) {
+        composed = QPixmap::fromImage(QImage(deviceSize, QImage::Format_RGB32), Qt::NoFormatConversion);
+    } else {
+        composed = QPixmap(deviceSize);
+        composed.fill(Qt::transparent);
+    }
+    composed.setDevicePixelRatio(devicePixelRatio);
+    QPainter composedPainter(&composed);
+    composedPainter.setRenderHint(QPainter::SmoothPixmapTransform, smooth);
+    qDrawBorderPixmap(&composedPainter, QRect(QPoint(0, 0), targetSize), targetMargins,
+                      pixmap, pixmap.rect(), sourceMargins, rules, hints);
+    composedPainter.end();
+
+    m_pixmap.setPixmap(composed);
+    return m_pixmap.pixmap();
+}
+
 }
 
 ImageNode::ImageNode()
     : m_innerSourceRect(0, 0, 1, 1)
     , m_subSourceRect(0, 0, 1, 1)
     , m_texture(0)
+    , m_tiledPixmapKey(0)
     , m_mirror(false)
     , m_smooth(true)
+    , m_mipmap(false)
     , m_tileHorizontal(false)
     , m_tileVertical(false)
     , m_cachedMirroredPixmapIsDirty(false)
@@ -356,7 +469,10 @@ void ImageNode::setTexture(QSGTexture *texture)
     if (m_texture != texture) {
         m_texture = texture;
         m_cachedMirroredPixmapIsDirty = true;
-        markDirty(DirtyMaterial);
+        m_scaledPixmap.clear();
+        m_tiledPixmap.clear();
+        m_borderOpacity.invalidate();
+            markDirty(DirtyMaterial);
     }
 }
 
@@ -369,8 +485,14 @@ void ImageNode::setMirror(bool mirror)
     }
 }
 
-void ImageNode::setMipmapFiltering(QSGTexture::Filtering /*filtering*/)
+void ImageNode::setMipmapFiltering(QSGTexture::Filtering filtering)
 {
+    bool mipmap = (filtering != QSGTexture::None);
+    if (mipmap == m_mipmap)
+        return;
+
+    m_mipmap = mipmap;
+    markDirty(DirtyMaterial);
 }
 
 void ImageNode::setFiltering(QSGTexture::Filtering filtering)
@@ -406,7 +528,9 @@ void ImageNode::setVerticalWrapMode(QSGTexture::WrapMode wrapMode)
 void ImageNode::update()
 {
     if (m_cachedMirroredPixmapIsDirty) {
-        if (m_mirror) {
+        // Pixmap textures share one mirrored copy between all nodes, only
+        // layers need a private one.
+        if (m_mirror && !qobject_cast<PixmapTexture *>(m_texture)) {
             m_cachedMirroredPixmap = pixmap().transformed(QTransform(-1, 0, 0, 1, 0, 0));
         } else {
             //Cleanup cached pixmap if necessary
@@ -421,12 +545,12 @@ void ImageNode::preprocess()
 {
     bool doDirty = false;
     QSGLayer *t = qobject_cast<QSGLayer *>(m_texture);
-    if (t) {
+    if (t)
         doDirty = t->updateTexture();
-        markDirty(DirtyGeometry);
-    }
+    //Only a new frame is a change, otherwise the layer's renderer would see
+    //this node change every frame and grab again
     if (doDirty)
-        markDirty(DirtyMaterial);
+        markDirty(DirtyGeometry | DirtyMaterial);
 }
 
 static Qt::TileRule getTileRule(qreal factor)
@@ -445,33 +569,175 @@ void ImageNode::paint(QPainter *painter)
 {
     painter->setRenderHint(QPainter::SmoothPixmapTransform, m_smooth);
 
-    const QPixmap &pm = m_mirror ? m_cachedMirroredPixmap : pixmap();
+    const QPixmap &pm = m_mirror ? mirroredPixmap() : pixmap();
 
     if (m_innerTargetRect != m_targetRect) {
         // border image
         QMargins margins(m_innerTargetRect.left() - m_targetRect.left(), m_innerTargetRect.top() - m_targetRect.top(),
                          m_targetRect.right() - m_innerTargetRect.right(), m_targetRect.bottom() - m_innerTargetRect.bottom());
         QTileRules tilerules(getTileRule(m_subSourceRect.width()), getTileRule(m_subSourceRect.height()));
-        SoftwareContext::qDrawBorderPixmap(painter, m_targetRect.toRect(), margins, pm, QRect(0, 0, pm.width(), pm.height()),
-                                           margins, tilerules, QDrawBorderPixmap::DrawingHints(0));
+        const QRect targetRect = m_targetRect.toRect();
+        const QRect sourceRect = textureRect(pm).toRect();
+        if (painter->transform().type() <= QTransform::TxTranslate && sourceRect == pm.rect()) {
+            const QPixmap &composed = m_borderCache.pixmap(targetRect.size(), painter->device()->devicePixelRatio(),
+                                                           margins, pm, margins, tilerules,
+                                                           m_borderOpacity.hints(pm, margins), m_smooth);
+            if (!composed.isNull()) {
+                painter->drawPixmap(targetRect.topLeft(), composed);
+                return;
+            }
+        }
+        SoftwareContext::qDrawBorderPixmap(painter, targetRect, margins, pm, sourceRect,
+                                           margins, tilerules, m_borderOpacity.hints(pm, margins));
         return;
     }
 
+    const QRectF texture = textureRect(pm);
+
     if (m_tileHorizontal || m_tileVertical) {
-        painter->save();
-        qreal sx = m_targetRect.width()/(m_subSourceRect.width()*pm.width());
-        qreal sy = m_targetRect.height()/(m_subSourceRect.height()*pm.height());
-        QMatrix transform(sx, 0, 0, sy, 0, 0);
-        painter->setMatrix(transform, true);
-        painter->drawTiledPixmap(QRectF(m_targetRect.x()/sx, m_targetRect.y()/sy, m_targetRect.width()/sx, m_targetRect.height()/sy),
-                                 pm,
-                                 QPointF(m_subSourceRect.left()*pm.width(), m_subSourceRect.top()*pm.height()));
-        painter->restore();
+        qreal sx = m_targetRect.width()/(m_subSourceRect.width()*texture.width());
+        qreal sy = m_targetRect.height()/(m_subSourceRect.height()*texture.height());
+        const QPixmap tile = tiledPixmap(pm, texture.toRect());
+        const QPointF offset(m_subSourceRect.left()*texture.width(), m_subSourceRect.top()*texture.height());
+        if (qFuzzyCompare(sx, qreal(1)) && qFuzzyCompare(sy, qreal(1))) {
+            // Unscaled repeat, no need to touch the painter state
+            painter->drawTiledPixmap(m_targetRect, tile, offset);
+        } else {
+            painter->save();
+            QMatrix transform(sx, 0, 0, sy, 0, 0);
+            painter->setMatrix(transform, true);
+            painter->drawTiledPixmap(QRectF(m_targetRect.x()/sx, m_targetRect.y()/sy, m_targetRect.width()/sx, m_targetRect.height()/sy),
+                                     tile, offset);
+            painter->restore();
+        }
     } else {
-        QRectF sr(m_subSourceRect.left()*pm.width(), m_subSourceRect.top()*pm.height(),
-                  m_subSourceRect.width()*pm.width(), m_subSourceRect.height()*pm.height());
-        painter->drawPixmap(m_targetRect, pm, sr);
+        const QPixmap *source = &pm;
+        QRectF sr(texture.x() + m_subSourceRect.left()*texture.width(),
+                  texture.y() + m_subSourceRect.top()*texture.height(),
+                  m_subSourceRect.width()*texture.width(), m_subSourceRect.height()*texture.height());
+
+        const int dpr = painter->device()->devicePixelRatio();
+        const QSize targetSize = (painter->transform().mapRect(m_targetRect).size() * dpr).toSize();
+
+        // Sample from the smallest pyramid level that still covers the target
+        // resolution, which avoids aliasing and touches far less memory.
+        PixmapTexture *pt = qobject_cast<PixmapTexture *>(m_texture);
+        if (m_mipmap && !m_mirror && pt) {
+            int level = 0;
+            QSizeF levelSize = sr.size();
+            while (levelSize.width() >= 2 * targetSize.width() && levelSize.height() >= 2 * targetSize.height()
+                   && levelSize.width() >= 2 && levelSize.height() >= 2) {
+                levelSize /= 2;
+                ++level;
+            }
+            if (level > 0) {
+                source = &pt->mipmapLevel(level);
+                const qreal sx = source->width() / qreal(pm.width());
+                const qreal sy = source->height() / qreal(pm.height());
+                sr = QRectF(sr.x() * sx, sr.y() * sy, sr.width() * sx, sr.height() * sy);
+            }
+        }
+
+        // Resampling a large image every frame is expensive, so keep the scaled
+        // result around and blit it 1:1 as long as nothing relevant changes.
+        if (painter->transform().type() <= QTransform::TxTranslate && targetSize != sr.size().toSize()) {
+            const QPixmap &scaled = scaledPixmap(*source, sr, targetSize);
+            if (!scaled.isNull()) {
+                painter->drawPixmap(m_targetRect.topLeft(), scaled);
+                return;
+            }
+        }
+
+        painter->drawPixmap(m_targetRect, *source, sr);
+    }
+}
+
+const QPixmap &ImageNode::scaledPixmap(const QPixmap &pm, const QRectF &sourceRect, const QSize &targetSize)
+{
+    static const QPixmap nullPixmap;
+
+    // Layers change every frame, and fractional source rects cannot be resampled
+    // exactly the same way QPainter does; leave those to drawPixmap().
+    const QRect alignedSourceRect = sourceRect.toRect();
+    if (!qobject_cast<PixmapTexture *>(m_texture) || QRectF(alignedSourceRect) != sourceRect
+            || targetSize.isEmpty()) {
+        m_scaledPixmap.clear();
+        return nullPixmap;
+    }
+
+    ScaledPixmapKey key;
+    key.cacheKey = pm.cacheKey();
+    key.targetSize = targetSize;
+    key.sourceRect = alignedSourceRect;
+    key.smooth = m_smooth;
+    if (key == m_scaledPixmapKey && !m_scaledPixmap.isNull())
+        return m_scaledPixmap.pixmap();
+
+    m_scaledPixmap.clear();
+    m_scaledPixmapKey = key;
+    if (!SoftwareContext::CachedPixmap::fitsBudget(targetSize))
+        return nullPixmap;
+
+    const QPixmap source = alignedSourceRect == pm.rect() ? pm : pm.copy(alignedSourceRect);
+    QPixmap scaled = source.scaled(targetSize, Qt::IgnoreAspectRatio,
+                                   m_smooth ? Qt::SmoothTransformation : Qt::FastTransformation);
+    scaled.setDevicePixelRatio(qreal(targetSize.width()) / m_targetRect.width());
+    m_scaledPixmap.setPixmap(scaled);
+    return m_scaledPixmap.pixmap();
+}
+
+QPixmap ImageNode::tiledPixmap(const QPixmap &pm, const QRect &sourceRect)
+{
+    // Tiles smaller than this get repeated into a larger block once, so that
+    // drawTiledPixmap() issues far fewer, longer blits per frame.
+    static const int minimumTileSize = 64;
+    static const int expandedTileSize = 256;
+
+    const bool whole = sourceRect == pm.rect();
+    const bool expand = (sourceRect.width() < minimumTileSize || sourceRect.height() < minimumTileSize)
+            && pm.devicePixelRatio() == 1 && qobject_cast<PixmapTexture *>(m_texture);
+    if (pm.isNull() || (whole && !expand)) {
+        m_tiledPixmap.clear();
+        return pm;
+    }
+
+    // Textures in part of their pixmap are cut out only when the tile is built
+    if (m_tiledPixmapKey == pm.cacheKey() && m_tiledSourceRect == sourceRect && !m_tiledPixmap.isNull())
+        return m_tiledPixmap.pixmap();
+
+    m_tiledPixmap.clear();
+    m_tiledPixmapKey = pm.cacheKey();
+    m_tiledSourceRect = sourceRect;
+
+    const QPixmap tile = whole ? pm : pm.copy(sourceRect);
+    if (!expand) {
+        m_tiledPixmap.setPixmap(tile);
+        return tile;
+    }
+
+    const int columns = sourceRect.width() < minimumTileSize ? qMax(1, expandedTileSize / sourceRect.width()) : 1;
+    const int rows = sourceRect.height() < minimumTileSize ? qMax(1, expandedTileSize / sourceRect.height()) : 1;
+    const QSize size(sourceRect.width() * columns, sourceRect.height() * rows);
+    if (!SoftwareContext::CachedPixmap::fitsBudget(size)) {
+        if (!whole)
+            m_tiledPixmap.setPixmap(tile);
+        return tile;
     }
+
+    QPixmap expanded(size);
+    if (pm.hasAlphaChannel())
+        expanded.fill(Qt::transparent);
+    QPainter expandedPainter(&expanded);
+    expandedPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < columns; ++x)
+            expandedPainter.drawPixmap(x * sourceRect.width(), y * sourceRect.height(), tile);
+    }
+    expandedPainter.end();
+
+    if (!m_tiledPixmap.setPixmap(expanded))
+        return tile;
+    return m_tiledPixmap.pixmap();
 }
 
 const QPixmap &ImageNode::pixmap() const
@@ -484,3 +750,20 @@ const QPixmap &ImageNode::pixmap() const
         qFatal("Image used with invalid texture format.");
     }
 }
+
+QRectF ImageNode::textureRect(const QPixmap &pm) const
+{
+    //Painted items keep their texture in the corner of a grow-only buffer
+    QRectF subRect = m_texture->normalizedTextureSubRect();
+    if (m_mirror)
+        subRect.moveLeft(1 - subRect.right());
+    return QRectF(subRect.x() * pm.width(), subRect.y() * pm.height(),
+                  subRect.width() * pm.width(), subRect.height() * pm.height());
+}
+
+const QPixmap &ImageNode::mirroredPixmap()
+{
+    if (PixmapTexture *pt = qobject_cast<PixmapTexture*>(m_texture))
+        return pt->mirroredPixmap();
+    return m_cachedMirroredPixmap;
+}
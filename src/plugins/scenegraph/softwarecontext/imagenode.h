@@ -33,6 +33,8 @@
 #include <private/qsgadaptationlayer_p.h>
 #include <private/qsgtexturematerial_p.h>
 
+#include "nodecache.h"
+
 typedef QVarLengthArray<QPainter::PixmapFragment, 16> QPixmapFragmentsArray;
 
 struct QTileRules
@@ -76,6 +78,46 @@ void qDrawBorderPixmap(QPainter *painter, const QRect &targetRect, const QMargin
                        const QPixmap &pixmap, const QRect &sourceRect,const QMargins &sourceMargins,
                        const QTileRules &rules, QDrawBorderPixmap::DrawingHints hints);
 
+// Finds the fully opaque patches of a border pixmap, so that they can be
+// drawn with CompositionMode_Source. The result is cached per pixmap and margins.
+class BorderPixmapOpacity
+{
+public:
+    BorderPixmapOpacity();
+
+    QDrawBorderPixmap::DrawingHints hints(const QPixmap &pixmap, const QMargins &sourceMargins);
+    void invalidate() { m_cacheKey = 0; }
+
+private:
+    qint64 m_cacheKey;
+    QMargins m_margins;
+    QDrawBorderPixmap::DrawingHints m_hints;
+};
+
+// Renders a border pixmap once per target size and keeps the composed result,
+// so static controls are drawn with a single blit instead of up to nine
+// scaled fragments.
+class BorderPixmapCache
+{
+public:
+    BorderPixmapCache();
+
+    const QPixmap &pixmap(const QSize &targetSize, int devicePixelRatio, const QMargins &targetMargins,
+                          const QPixmap &pixmap, const QMargins &sourceMargins,
+                          const QTileRules &rules, QDrawBorderPixmap::DrawingHints hints, bool smooth);
+
+private:
+    CachedPixmap m_pixmap;
+    qint64 m_cacheKey;
+    QSize m_targetSize;
+    int m_devicePixelRatio;
+    QMargins m_targetMargins;
+    QMargins m_sourceMargins;
+    Qt::TileRule m_horizontalRule;
+    Qt::TileRule m_verticalRule;
+    bool m_smooth;
+};
+
 }
 
 class ImageNode : public QSGImageNode
@@ -98,9 +140,15 @@ public:
     void preprocess() override;
 
     void paint(QPainter *painter);
+    QRectF rect() const { return m_targetRect; }
+    QSGTexture *texture() const { return m_texture; }
 
 private:
     const QPixmap &pixmap() const;
+    QRectF textureRect(const QPixmap &pm) const;
+    const QPixmap &mirroredPixmap();
+    const QPixmap &scaledPixmap(const QPixmap &pm, const QRectF &sourceRect, const QSize &targetSize);
+    QPixmap tiledPixmap(const QPixmap &pm, const QRect &sourceRect);
 
     QRectF m_targetRect;
     QRectF m_innerTargetRect;
@@ -110,8 +158,33 @@ private:
     QSGTexture *m_texture;
     QPixmap m_cachedMirroredPixmap;
 
+    struct ScaledPixmapKey
+    {
+        ScaledPixmapKey() : cacheKey(0), smooth(false) {}
+        bool operator==(const ScaledPixmapKey &other) const
+        {
+            return cacheKey == other.cacheKey && targetSize == other.targetSize
+                    && sourceRect == other.sourceRect && smooth == other.smooth;
+        }
+
+        qint64 cacheKey;
+        QSize targetSize;
+        QRect sourceRect;
+        bool smooth;
+    };
+    ScaledPixmapKey m_scaledPixmapKey;
+    SoftwareContext::CachedPixmap m_scaledPixmap;
+
+    qint64 m_tiledPixmapKey;
+    QRect m_tiledSourceRect;
+    SoftwareContext::CachedPixmap m_tiledPixmap;
+
+    SoftwareContext::BorderPixmapOpacity m_borderOpacity;
+    SoftwareContext::BorderPixmapCache m_borderCache;
+
     bool m_mirror;
     bool m_smooth;
+    bool m_mipmap;
     bool m_tileHorizontal;
     bool m_tileVertical;
     bool m_cachedMirroredPixmapIsDirty;
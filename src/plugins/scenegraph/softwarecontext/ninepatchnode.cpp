@@ -45,6 +45,8 @@ void NinePatchNode::setTexture(QSGTexture *texture)
         return;
     }
     m_pixmap = pt->pixmap();
+    m_opacity.invalidate();
+    m_cache.invalidate();
     markDirty(DirtyMaterial);
 }
 
@@ -54,6 +56,7 @@ void NinePatchNode::setBounds(const QRectF &bounds)
         return;
 
     m_bounds = bounds;
+    m_cache.invalidate();
     markDirty(DirtyGeometry);
 }
 
@@ -73,6 +76,7 @@ void NinePatchNode::setPadding(qreal left, qreal top, qreal right, qreal bottom)
         return;
 
     m_margins = QMargins(qRound(left), qRound(top), qRound(right), qRound(bottom));
+    m_cache.invalidate();
     markDirty(DirtyGeometry);
 }
 
@@ -82,9 +86,23 @@ void NinePatchNode::update()
 
 void NinePatchNode::paint(QPainter *painter)
 {
-    if (m_margins.isNull())
+    if (m_margins.isNull()) {
         painter->drawPixmap(m_bounds, m_pixmap, QRectF(0, 0, m_pixmap.width(), m_pixmap.height()));
-    else
-        SoftwareContext::qDrawBorderPixmap(painter, m_bounds.toRect(), m_margins, m_pixmap, QRect(0, 0, m_pixmap.width(), m_pixmap.height()),
-                                           m_margins, Qt::StretchTile, QDrawBorderPixmap::DrawingHints(0));
+        return;
+    }
+
+    const QRect bounds = m_bounds.toRect();
+    if (painter->transform().type() <= QTransform::TxTranslate) {
+        const QPixmap &composed = m_cache.pixmap(bounds.size(), painter->device()->devicePixelRatio(),
+                                                 m_margins, m_pixmap, m_margins, Qt::StretchTile,
+                                                 m_opacity.hints(m_pixmap, m_margins),
+                                                 painter->testRenderHint(QPainter::SmoothPixmapTransform));
+        if (!composed.isNull()) {
+            painter->drawPixmap(bounds.topLeft(), composed);
+            return;
+        }
+    }
+
+    SoftwareContext::qDrawBorderPixmap(painter, bounds, m_margins, m_pixmap, QRect(0, 0, m_pixmap.width(), m_pixmap.height()),
+                                       m_margins, Qt::StretchTile, m_opacity.hints(m_pixmap, m_margins));
 }
@@ -32,6 +32,8 @@
 
 #include <private/qsgadaptationlayer_p.h>
 
+#include "imagenode.h"
+
 class NinePatchNode : public QSGNinePatchNode
 {
 public:    
@@ -44,12 +46,15 @@ public:
     void update() override;
 
     void paint(QPainter *painter);
+    QRectF bounds() const { return m_bounds; }
 
 private:
     QPixmap m_pixmap;
     QRectF m_bounds;
     qreal m_pixelRatio;
     QMargins m_margins;
+    SoftwareContext::BorderPixmapOpacity m_opacity;
+    SoftwareContext::BorderPixmapCache m_cache;
 };
 
 #endif // NINEPATCHNODE_H
@@ -0,0 +1,117 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "nodecache.h"
+
+#include <QtCore/QAtomicInt>
+
+namespace SoftwareContext {
+
+static QBasicAtomicInt qsg_node_cache_used = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+static qint64 qsg_node_cache_limit()
+{
+    bool ok = false;
+    const int kbytes = qgetenv("QSG_RASTER_NODE_CACHE_SIZE").toInt(&ok);
+    return ok ? qMax(0, kbytes) * qint64(1024) : qint64(16 * 1024 * 1024);
+}
+
+bool NodeCacheBudget::reserve(qint64 bytes)
+{
+    if (bytes <= 0)
+        return true;
+    if (bytes > limit())
+        return false;
+
+    // The limit stays well below 2 GB, so a plain int can hold the total.
+    const int used = qsg_node_cache_used.fetchAndAddRelaxed(int(bytes)) + int(bytes);
+    if (used > limit()) {
+        qsg_node_cache_used.fetchAndAddRelaxed(-int(bytes));
+        return false;
+    }
+    return true;
+}
+
+void NodeCacheBudget::release(qint64 bytes)
+{
+    if (bytes > 0)
+        qsg_node_cache_used.fetchAndAddRelaxed(-int(bytes));
+}
+
+qint64 NodeCacheBudget::usedBytes()
+{
+    return qsg_node_cache_used.load();
+}
+
+qint64 NodeCacheBudget::limit()
+{
+    static const qint64 limit = qMin(qsg_node_cache_limit(), qint64(1024 * 1024 * 1024));
+    return limit;
+}
+
+CachedPixmap::CachedPixmap()
+    : m_bytes(0)
+{
+}
+
+CachedPixmap::~CachedPixmap()
+{
+    clear();
+}
+
+bool CachedPixmap::setPixmap(const QPixmap &pixmap)
+{
+    clear();
+    if (pixmap.isNull())
+        return false;
+
+    const qint64 bytes = qint64(pixmap.width()) * pixmap.height() * qMax(1, pixmap.depth() / 8);
+    if (!NodeCacheBudget::reserve(bytes))
+        return false;
+
+    m_pixmap = pixmap;
+    m_bytes = bytes;
+    return true;
+}
+
+void CachedPixmap::clear()
+{
+    NodeCacheBudget::release(m_bytes);
+    m_bytes = 0;
+    m_pixmap = QPixmap();
+}
+
+bool CachedPixmap::fitsBudget(const QSize &size)
+{
+    const qint64 bytes = qint64(size.width()) * size.height() * 4;
+    return !size.isEmpty() && bytes <= NodeCacheBudget::limit() - NodeCacheBudget::usedBytes();
+}
+
+} // namespace
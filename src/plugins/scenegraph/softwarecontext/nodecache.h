@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef NODECACHE_H
+#define NODECACHE_H
+
+#include <QtGui/QPixmap>
+
+namespace SoftwareContext {
+
+// Per-node pixmap caches share a process-wide byte budget, configurable with
+// QSG_RASTER_NODE_CACHE_SIZE (in kilobytes, 0 disables the caches).
+class NodeCacheBudget
+{
+public:
+    static bool reserve(qint64 bytes);
+    static void release(qint64 bytes);
+    static qint64 usedBytes();
+    static qint64 limit();
+};
+
+class CachedPixmap
+{
+public:
+    CachedPixmap();
+    ~CachedPixmap();
+
+    // Returns false and leaves the cache empty if the budget is exhausted.
+    bool setPixmap(const QPixmap &pixmap);
+    void clear();
+
+    const QPixmap &pixmap() const { return m_pixmap; }
+    bool isNull() const { return m_pixmap.isNull(); }
+
+    static bool fitsBudget(const QSize &size);
+
+private:
+    Q_DISABLE_COPY(CachedPixmap)
+
+    QPixmap m_pixmap;
+    qint64 m_bytes;
+};
+
+} // namespace
+
+#endif // NODECACHE_H
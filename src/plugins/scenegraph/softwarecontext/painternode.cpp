@@ -28,14 +28,35 @@
 ****************************************************************************/
 
 #include "painternode.h"
+#include "context.h"
+#include "pixmappool.h"
 #include "pixmaptexture.h"
+#include "spanfiller.h"
 #include <qmath.h>
 
-PainterNode::PainterNode(QQuickPaintedItem *item)
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+#include <private/qguiapplication_p.h>
+#include <qpa/qplatformintegration.h>
+
+class PainterJob : public QRunnable
+{
+public:
+    explicit PainterJob(PainterNode *node) : m_node(node) {}
+    void run() override { m_node->paint(); }
+
+private:
+    PainterNode *m_node;
+};
+
+PainterNode::PainterNode(QQuickPaintedItem *item, SoftwareContext::RenderContext *renderContext)
     : QSGPainterNode()
     , m_preferredRenderTarget(QQuickPaintedItem::Image)
     , m_actualRenderTarget(QQuickPaintedItem::Image)
     , m_item(item)
+    , m_jobs(renderContext ? &renderContext->painterJobs : 0)
+    , m_threadedPainting(false)
     , m_texture(0)
     , m_dirtyContents(false)
     , m_opaquePainting(false)
@@ -51,19 +72,51 @@ PainterNode::PainterNode(QQuickPaintedItem *item)
 {
     setMaterial((QSGMaterial*)1);
     setGeometry((QSGGeometry*)1);
+
+    static const bool threadedPixmaps =
+            QGuiApplicationPrivate::platformIntegration()->hasCapability(QPlatformIntegration::ThreadedPixmaps);
+    m_threadedPainting = m_jobs && threadedPixmaps && item->property("threadedPainting").toBool();
 }
 
 PainterNode::~PainterNode()
 {
+    if (m_threadedPainting) {
+        QMutexLocker lock(&m_jobs->mutex);
+        if (m_jobs->nodes.contains(this)) {
+            lock.unlock();
+            m_jobs->pool.waitForDone();
+            lock.relock();
+            m_jobs->nodes.removeAll(this);
+        }
+    }
     delete m_texture;
 }
 
+void PainterNode::finishPaint()
+{
+    static_cast<PixmapTexture *>(m_texture)->setPixmap(m_pixmap, QRect(QPoint(), m_textureSize));
+}
+
+void PainterNode::finishThreadedPainting(SoftwareContext::RenderContext *renderContext)
+{
+    SoftwareContext::PainterJobs *jobs = &renderContext->painterJobs;
+    jobs->pool.waitForDone();
+
+    QMutexLocker lock(&jobs->mutex);
+    foreach (PainterNode *node, jobs->nodes)
+        node->finishPaint();
+    jobs->nodes.clear();
+}
+
 void PainterNode::setPreferredRenderTarget(QQuickPaintedItem::RenderTarget target)
 {
     if (m_preferredRenderTarget == target)
         return;
 
     m_preferredRenderTarget = target;
+    m_actualRenderTarget = target;
+    m_dirtyGeometry = true;
+    m_dirtyContents = true;
 }
 
 void PainterNode::setSize(const QSize &size)
@@ -76,10 +129,18 @@ void PainterNode::setSize(const QSize &size)
     m_dirtyGeometry = true;
 }
 
+//Beyond this many rects repainting the bounding rect is cheaper than clipping
+static const int qsg_painter_max_dirty_rects = 8;
+
 void PainterNode::setDirty(const QRect &dirtyRect)
 {
     m_dirtyContents = true;
-    m_dirtyRect = dirtyRect;
+    if (dirtyRect.isNull())
+        m_dirtyRegion = QRect(QPoint(), m_size);
+    else
+        m_dirtyRegion |= dirtyRect;
+    if (m_dirtyRegion.rectCount() > qsg_painter_max_dirty_rects)
+        m_dirtyRegion = m_dirtyRegion.boundingRect();
     markDirty(DirtyMaterial);
 }
 
@@ -89,6 +150,7 @@ void PainterNode::setOpaquePainting(bool opaque)
         return;
 
     m_opaquePainting = opaque;
+    m_dirtyGeometry = true;
 }
 
 void PainterNode::setLinearFiltering(bool linearFiltering)
@@ -135,41 +197,220 @@ void PainterNode::setContentsScale(qreal s)
 
 void PainterNode::setFastFBOResizing(bool dynamic)
 {
+    if (m_fastFBOResizing == dynamic)
+        return;
+
     m_fastFBOResizing = dynamic;
+    m_dirtyGeometry = true;
+}
+
+//Grow-only buffers are allocated in steps of this many pixels
+static const int qsg_painter_buffer_step = 64;
+//and shrink once they were more than twice the size needed for this long
+static const int qsg_painter_buffer_shrink_delay = 2000;
+
+static QSize roundedBufferSize(const QSize &size)
+{
+    const int step = qsg_painter_buffer_step;
+    return QSize((size.width() + step - 1) / step * step, (size.height() + step - 1) / step * step);
+}
+
+bool PainterNode::reuseBuffer()
+{
+    const QSize capacity = m_pixmap.size();
+    if (!m_fastFBOResizing || capacity.width() < m_textureSize.width() || capacity.height() < m_textureSize.height()
+            || m_pixmap.hasAlphaChannel() == m_opaquePainting)
+        return false;
+
+    if (m_textureSize.width() * 2 > capacity.width() && m_textureSize.height() * 2 > capacity.height()) {
+        m_shrinkTimer.invalidate();
+        return true;
+    }
+
+    //The item is likely to grow back during a resize animation
+    if (!m_shrinkTimer.isValid())
+        m_shrinkTimer.start();
+    return m_shrinkTimer.elapsed() < qsg_painter_buffer_shrink_delay;
 }
 
 QImage PainterNode::toImage() const
 {
+    if (paintsDirectly()) {
+        QImage image(m_size, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        painter.drawPicture(0, 0, m_picture);
+        return image;
+    }
+    if (m_pixmap.size() != m_textureSize)
+        return m_pixmap.copy(QRect(QPoint(), m_textureSize)).toImage();
     return m_pixmap.toImage();
 }
 
+QSGTexture *PainterNode::texture() const
+{
+    if (paintsDirectly())
+        const_cast<PainterNode *>(this)->bufferRecording();
+    return m_texture;
+}
+
+void PainterNode::bufferRecording()
+{
+    //The recording is replayed once into a buffer, following updates paint it
+    m_actualRenderTarget = QQuickPaintedItem::Image;
+
+    m_pixmap = QPixmap();
+    if (!m_texture)
+        m_texture = new PixmapTexture(QPixmap());
+    if (m_textureSize.isEmpty() || m_size.isEmpty()) {
+        static_cast<PixmapTexture *>(m_texture)->setPixmap(QPixmap());
+        return;
+    }
+
+    m_pixmap = SoftwareContext::PixmapPool::acquire(m_textureSize, m_opaquePainting);
+    if (!m_opaquePainting)
+        m_pixmap.fill(Qt::transparent);
+
+    QPainter painter(&m_pixmap);
+    painter.scale(m_textureSize.width() / qreal(m_size.width()),
+                  m_textureSize.height() / qreal(m_size.height()));
+    painter.drawPicture(0, 0, m_picture);
+    painter.end();
+
+    finishPaint();
+}
+
 void PainterNode::update()
 {
-    if (m_dirtyGeometry) {
-        m_pixmap = QPixmap(m_textureSize);
-        if (!m_opaquePainting)
-            m_pixmap.fill(Qt::transparent);
+    //A shrinking item leaves its old area to whatever is painted below it
+    m_uncoveredRegion = QRegion(QRect(QPoint(), m_previousSize)) - QRect(QPoint(), m_size);
+    m_previousSize = m_size;
 
-        if (m_texture)
+    if (paintsDirectly()) {
+        if (m_dirtyGeometry) {
+            m_pixmap = QPixmap();
             delete m_texture;
-        m_texture = new PixmapTexture(m_pixmap);
+            m_texture = 0;
+        }
+        if (m_dirtyContents || m_dirtyGeometry)
+            record();
+        else
+            m_paintedRegion = QRegion();
+
+        m_dirtyGeometry = false;
+        m_dirtyContents = false;
+        return;
+    }
+
+    //An oversized buffer is dropped on the first update after its delay
+    if (!m_dirtyGeometry && m_fastFBOResizing && !m_pixmap.isNull() && !reuseBuffer()) {
+        m_dirtyGeometry = true;
+        m_dirtyContents = true;
+    }
+
+    if (m_dirtyGeometry && !reuseBuffer()) {
+        m_shrinkTimer.invalidate();
+        const QSize bufferSize = m_fastFBOResizing ? roundedBufferSize(m_textureSize) : m_textureSize;
+        //Opaque items get a buffer without alpha, which blits without blending
+        m_pixmap = QPixmap();
+        m_pixmap = SoftwareContext::PixmapPool::acquire(bufferSize, m_opaquePainting);
+        if (!m_opaquePainting)
+            m_pixmap.fill(Qt::transparent);
     }
 
-    if (m_dirtyContents)
+    if (!m_texture)
+        m_texture = new PixmapTexture(QPixmap());
+    PixmapTexture *texture = static_cast<PixmapTexture *>(m_texture);
+
+    //The texture lets go of the buffer while it is painted, otherwise the
+    //painter would detach and copy it
+    if (m_dirtyContents) {
+        texture->setPixmap(QPixmap());
+        if (m_threadedPainting) {
+            QMutexLocker lock(&m_jobs->mutex);
+            m_jobs->nodes.append(this);
+            m_jobs->pool.start(new PainterJob(this));
+            m_dirtyGeometry = false;
+            m_dirtyContents = false;
+            return;
+        }
         paint();
+    } else {
+        m_paintedRegion = QRegion();
+    }
+    finishPaint();
 
     m_dirtyGeometry = false;
     m_dirtyContents = false;
 }
 
-void PainterNode::paint(QPainter *painter)
+void PainterNode::paint(QPainter *painter, const SoftwareContext::DirectClip &clip)
 {
-    painter->drawPixmap(0, 0, m_size.width(), m_size.height(), m_pixmap);
+    if (paintsDirectly()) {
+        painter->save();
+        painter->setClipRect(QRect(QPoint(), m_size), Qt::IntersectClip);
+        painter->drawPicture(0, 0, m_picture);
+        painter->restore();
+        return;
+    }
+
+    //Opaque buffers shown at their own size are copied straight into the target
+    if (m_opaquePainting && m_size == m_textureSize) {
+        SoftwareContext::DirectTarget target;
+        if (SoftwareContext::directTarget(painter, clip, QRect(QPoint(), m_size), &target)
+                && SoftwareContext::blitOpaque(target, QPoint(), m_pixmap, QRect(QPoint(), m_textureSize)))
+            return;
+    }
+
+    painter->drawPixmap(QRectF(0, 0, m_size.width(), m_size.height()), m_pixmap,
+                        QRectF(0, 0, m_textureSize.width(), m_textureSize.height()));
+}
+
+void PainterNode::record()
+{
+    //The item paints on the render thread while the gui thread is blocked in
+    //sync, so only the recorded commands are used at render time. The whole
+    //item is recorded since there is no buffer to keep undirtied parts.
+    m_picture = QPicture();
+
+    QPainter painter(&m_picture);
+    if (m_smoothPainting)
+        painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
+
+    if (m_fillColor.alpha() > 0)
+        painter.fillRect(QRect(QPoint(), m_size), m_fillColor);
+
+    //The item paints in contents coordinates, which the buffered path scales
+    //into the texture and the texture back to the item size
+    if (m_contentsScale != 1 && !m_textureSize.isEmpty()) {
+        painter.scale(m_contentsScale * m_size.width() / qreal(m_textureSize.width()),
+                      m_contentsScale * m_size.height() / qreal(m_textureSize.height()));
+    }
+
+    m_item->paint(&painter);
+    painter.end();
+
+    m_paintedRegion = QRect(QPoint(), m_size);
+    m_dirtyRegion = QRegion();
+}
+
+QRect PainterNode::clipRect(const QRect &dirtyRect) const
+{
+    if (m_contentsScale == 1)
+        return dirtyRect;
+
+    return QRect(qFloor(dirtyRect.x()/m_contentsScale),
+                 qFloor(dirtyRect.y()/m_contentsScale),
+                 qCeil(dirtyRect.width()/m_contentsScale+dirtyRect.x()/m_contentsScale-qFloor(dirtyRect.x()/m_contentsScale)),
+                 qCeil(dirtyRect.height()/m_contentsScale+dirtyRect.y()/m_contentsScale-qFloor(dirtyRect.y()/m_contentsScale)));
 }
 
 void PainterNode::paint()
 {
-    QRect dirtyRect = m_dirtyRect.isNull() ? QRect(0, 0, m_size.width(), m_size.height()) : m_dirtyRect;
+    const QRect itemRect(QPoint(), m_size);
+    QRegion dirtyRegion = m_dirtyRegion & itemRect;
+    if (m_dirtyGeometry || dirtyRegion.isEmpty())
+        dirtyRegion = itemRect;
 
     QPainter painter;
 
@@ -178,35 +419,31 @@ void PainterNode::paint()
         painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
     }
 
-    QRect clipRect;
-
     if (m_contentsScale == 1) {
         qreal scaleX = m_textureSize.width() / (qreal) m_size.width();
         qreal scaleY = m_textureSize.height() / (qreal) m_size.height();
         painter.scale(scaleX, scaleY);
-        clipRect = dirtyRect;
     } else {
         painter.scale(m_contentsScale, m_contentsScale);
-
-        QRect sclip(qFloor(dirtyRect.x()/m_contentsScale),
-                    qFloor(dirtyRect.y()/m_contentsScale),
-                    qCeil(dirtyRect.width()/m_contentsScale+dirtyRect.x()/m_contentsScale-qFloor(dirtyRect.x()/m_contentsScale)),
-                    qCeil(dirtyRect.height()/m_contentsScale+dirtyRect.y()/m_contentsScale-qFloor(dirtyRect.y()/m_contentsScale)));
-
-        clipRect = sclip;
     }
 
-    if (!m_dirtyRect.isNull())
-        painter.setClipRect(clipRect);
+    QRegion clipRegion;
+    foreach (const QRect &rect, dirtyRegion.rects())
+        clipRegion |= clipRect(rect);
+
+    if (dirtyRegion != QRegion(itemRect))
+        painter.setClipRegion(clipRegion);
 
     painter.setCompositionMode(QPainter::CompositionMode_Source);
-    painter.fillRect(clipRect, m_fillColor);
+    foreach (const QRect &rect, clipRegion.rects())
+        painter.fillRect(rect, m_fillColor);
     painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
 
     m_item->paint(&painter);
     painter.end();
 
-    m_dirtyRect = QRect();
+    m_paintedRegion = dirtyRegion;
+    m_dirtyRegion = QRegion();
 }
 
 
@@ -33,12 +33,22 @@
 #include <private/qsgadaptationlayer_p.h>
 #include <QtQuick/qquickpainteditem.h>
 
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QPicture>
 #include <QtGui/QPixmap>
 
+#include "spanfiller.h"
+
+namespace SoftwareContext
+{
+struct PainterJobs;
+class RenderContext;
+}
+
 class PainterNode : public QSGPainterNode
 {
 public:
-    PainterNode(QQuickPaintedItem *item);
+    PainterNode(QQuickPaintedItem *item, SoftwareContext::RenderContext *renderContext);
     ~PainterNode();
 
     void setPreferredRenderTarget(QQuickPaintedItem::RenderTarget target) override;
@@ -71,28 +81,53 @@ public:
 
     QImage toImage() const override;
     void update() override;
-    QSGTexture *texture() const override { return m_texture; }
+    QSGTexture *texture() const override;
 
-    void paint(QPainter *painter);
+    void paint(QPainter *painter, const SoftwareContext::DirectClip &clip);
 
     void paint();
 
     void setTextureSize(const QSize &size) override;
     QSize textureSize() const { return m_textureSize; }
 
+    // The part of the item, in item coordinates, repainted by the last update
+    // and the part it stopped covering when it shrank
+    QRegion paintedRegion() const { return m_paintedRegion | m_uncoveredRegion; }
+
+    // Items with a true "threadedPainting" property when their node is created
+    // declare their paint() thread safe. They are painted in parallel during
+    // sync on the pool of their render context, and the render loops
+    // wait for them here before releasing the gui thread.
+    static void finishThreadedPainting(SoftwareContext::RenderContext *renderContext);
+
 private:
+    // Items asking for a framebuffer object have no buffer at all. Their
+    // content is recorded during sync and played back into the scene painter.
+    // Once a layer or shader effect asks for a texture they are buffered again.
+    bool paintsDirectly() const { return m_actualRenderTarget != QQuickPaintedItem::Image; }
+    void record();
+    void bufferRecording();
+    QRect clipRect(const QRect &dirtyRect) const;
+    bool reuseBuffer();
+    void finishPaint();
 
     QQuickPaintedItem::RenderTarget m_preferredRenderTarget;
     QQuickPaintedItem::RenderTarget m_actualRenderTarget;
 
     QQuickPaintedItem *m_item;
+    SoftwareContext::PainterJobs *m_jobs;
+    bool m_threadedPainting;
 
     QPixmap m_pixmap;
     QSGTexture *m_texture;
+    QPicture m_picture;
 
     QSize m_size;
     bool m_dirtyContents;
-    QRect m_dirtyRect;
+    QRegion m_dirtyRegion;
+    QRegion m_paintedRegion;
+    QRegion m_uncoveredRegion;
+    QSize m_previousSize;
     bool m_opaquePainting;
     bool m_linear_filtering;
     bool m_mipmapping;
@@ -100,6 +135,8 @@ private:
     bool m_extensionsChecked;
     bool m_multisamplingSupported;
     bool m_fastFBOResizing;
+    // Runs while a grow-only buffer is much larger than the item
+    QElapsedTimer m_shrinkTimer;
     QColor m_fillColor;
     qreal m_contentsScale;
     QSize m_textureSize;
@@ -0,0 +1,202 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "pixmappool.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include <stdlib.h>
+#include <utility>
+
+namespace SoftwareContext {
+
+// Smaller buffers are cheap to allocate and would waste most of a bucket
+static const int qsg_pixmap_pool_minimum_size = 64;
+// Frames a buffer stays in the pool without being reused
+static const int qsg_pixmap_pool_idle_frames = 60;
+
+static qint64 qsg_pixmap_pool_limit()
+{
+    bool ok = false;
+    const int kbytes = qgetenv("QSG_RASTER_PIXMAP_POOL_SIZE").toInt(&ok);
+    return ok ? qMax(0, kbytes) * qint64(1024) : qint64(16 * 1024 * 1024);
+}
+
+struct PooledBuffer
+{
+    uchar *data;
+    QSize bucket;
+    int idleSince;
+};
+
+static inline qint64 bucketBytes(const QSize &bucket)
+{
+    return qint64(bucket.width()) * bucket.height() * 4;
+}
+
+static inline quint64 bucketKey(const QSize &bucket)
+{
+    return (quint64(bucket.width()) << 32) | quint32(bucket.height());
+}
+
+static void freeBuffer(PooledBuffer *buffer)
+{
+    ::free(buffer->data);
+    delete buffer;
+}
+
+struct PixmapPoolData
+{
+    PixmapPoolData()
+        : limit(qMin(qsg_pixmap_pool_limit(), qint64(1024 * 1024 * 1024)))
+        , idleBytes(0)
+        , frame(0)
+    {
+    }
+
+    ~PixmapPoolData()
+    {
+        foreach (const QVector<PooledBuffer *> &buffers, idle) {
+            foreach (PooledBuffer *buffer, buffers)
+                freeBuffer(buffer);
+        }
+    }
+
+    QMutex mutex;
+    const qint64 limit;
+    qint64 idleBytes;
+    int frame;
+    // Most recently returned buffers last
+    QHash<quint64, QVector<PooledBuffer *> > idle;
+};
+
+Q_GLOBAL_STATIC(PixmapPoolData, qsg_pixmap_pool)
+
+//Runs when the last image or pixmap sharing the buffer goes away, on any thread
+static void returnBuffer(void *info)
+{
+    PooledBuffer *buffer = static_cast<PooledBuffer *>(info);
+    if (!qsg_pixmap_pool.isDestroyed()) {
+        PixmapPoolData *pool = qsg_pixmap_pool();
+        const qint64 bytes = bucketBytes(buffer->bucket);
+        QMutexLocker lock(&pool->mutex);
+        if (pool->idleBytes + bytes <= pool->limit) {
+            buffer->idleSince = pool->frame;
+            pool->idle[bucketKey(buffer->bucket)].append(buffer);
+            pool->idleBytes += bytes;
+            return;
+        }
+    }
+    freeBuffer(buffer);
+}
+
+//Rounds up to a multiple of the largest power of two not above an eighth of
+//the length, which wastes at most 12.5% in each direction
+static inline int roundedToBucket(int length)
+{
+    int step = 1;
+    while (step * 16 <= length)
+        step *= 2;
+    return (length + step - 1) / step * step;
+}
+
+QPixmap PixmapPool::acquire(const QSize &size, bool opaque)
+{
+    if (size.isEmpty())
+        return QPixmap();
+
+    const QImage::Format format = opaque ? QImage::Format_RGB32 : QImage::Format_ARGB32_Premultiplied;
+    if (size.width() < qsg_pixmap_pool_minimum_size || size.height() < qsg_pixmap_pool_minimum_size)
+        return QPixmap::fromImage(QImage(size, format), Qt::NoFormatConversion);
+
+    const QSize bucket(roundedToBucket(size.width()), roundedToBucket(size.height()));
+    const qint64 bytes = bucketBytes(bucket);
+    PixmapPoolData *pool = qsg_pixmap_pool();
+    if (bytes > pool->limit)
+        return QPixmap::fromImage(QImage(size, format), Qt::NoFormatConversion);
+
+    PooledBuffer *buffer = 0;
+    {
+        QMutexLocker lock(&pool->mutex);
+        QHash<quint64, QVector<PooledBuffer *> >::iterator it = pool->idle.find(bucketKey(bucket));
+        if (it != pool->idle.end()) {
+            buffer = it->takeLast();
+            if (it->isEmpty())
+                pool->idle.erase(it);
+            pool->idleBytes -= bytes;
+        }
+    }
+
+    if (!buffer) {
+        uchar *data = static_cast<uchar *>(::malloc(bytes));
+        if (!data)
+            return QPixmap();
+        buffer = new PooledBuffer;
+        buffer->data = data;
+        buffer->bucket = bucket;
+        buffer->idleSince = 0;
+    }
+
+    //The pixmap shares the image's data instead of copying it, so the
+    //buffer comes back through the cleanup function
+    QImage image(buffer->data, size.width(), size.height(), bucket.width() * 4, format,
+                 returnBuffer, buffer);
+    return QPixmap::fromImage(std::move(image), Qt::NoFormatConversion);
+}
+
+void PixmapPool::trim()
+{
+    PixmapPoolData *pool = qsg_pixmap_pool();
+    QMutexLocker lock(&pool->mutex);
+    ++pool->frame;
+    if (pool->idle.isEmpty())
+        return;
+
+    QHash<quint64, QVector<PooledBuffer *> >::iterator it = pool->idle.begin();
+    while (it != pool->idle.end()) {
+        QVector<PooledBuffer *> &buffers = *it;
+        //Oldest buffers first
+        int expired = 0;
+        while (expired < buffers.size() && pool->frame - buffers.at(expired)->idleSince > qsg_pixmap_pool_idle_frames) {
+            pool->idleBytes -= bucketBytes(buffers.at(expired)->bucket);
+            freeBuffer(buffers.at(expired));
+            ++expired;
+        }
+        buffers.remove(0, expired);
+        if (buffers.isEmpty())
+            it = pool->idle.erase(it);
+        else
+            ++it;
+    }
+}
+
+} // namespace
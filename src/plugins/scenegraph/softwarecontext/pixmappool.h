@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef PIXMAPPOOL_H
+#define PIXMAPPOOL_H
+
+#include <QtGui/QPixmap>
+
+namespace SoftwareContext {
+
+// Recycles the memory of raster buffers that are allocated over and over,
+// like layer textures while an item is resized. Buffers of at least 64
+// pixels in each direction are grouped in buckets of sizes rounded up by at
+// most an eighth, smaller ones are allocated at their exact size. A pixmap's
+// memory goes back to the pool when its last copy is gone. Idle memory is
+// capped by QSG_RASTER_PIXMAP_POOL_SIZE (in kilobytes, 0 disables the pool).
+class PixmapPool
+{
+public:
+    // The contents of the returned pixmap are undefined.
+    static QPixmap acquire(const QSize &size, bool opaque = false);
+
+    // Called once per frame, frees buffers that have not been reused lately.
+    static void trim();
+};
+
+} // namespace
+
+#endif // PIXMAPPOOL_H
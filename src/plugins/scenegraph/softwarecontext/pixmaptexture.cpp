@@ -49,7 +49,23 @@ int PixmapTexture::textureId() const
 
 QSize PixmapTexture::textureSize() const
 {
-    return m_pixmap.size();
+    return m_subRect.isValid() ? m_subRect.size() : m_pixmap.size();
+}
+
+QRectF PixmapTexture::normalizedTextureSubRect() const
+{
+    if (!m_subRect.isValid() || m_pixmap.isNull())
+        return QRectF(0, 0, 1, 1);
+    return QRectF(qreal(m_subRect.x()) / m_pixmap.width(), qreal(m_subRect.y()) / m_pixmap.height(),
+                  qreal(m_subRect.width()) / m_pixmap.width(), qreal(m_subRect.height()) / m_pixmap.height());
+}
+
+void PixmapTexture::setPixmap(const QPixmap &pixmap, const QRect &subRect)
+{
+    m_pixmap = pixmap;
+    m_subRect = subRect == pixmap.rect() ? QRect() : subRect;
+    m_mirroredPixmap = QPixmap();
+    m_mipmaps.clear();
 }
 
 bool PixmapTexture::hasAlphaChannel() const
@@ -62,6 +78,28 @@ bool PixmapTexture::hasMipmaps() const
     return false;
 }
 
+const QPixmap &PixmapTexture::mipmapLevel(int level)
+{
+    if (level <= 0)
+        return m_pixmap;
+
+    while (m_mipmaps.size() < level) {
+        const QPixmap &previous = m_mipmaps.isEmpty() ? m_pixmap : m_mipmaps.last();
+        if (previous.width() <= 1 && previous.height() <= 1)
+            return previous;
+        m_mipmaps.append(previous.scaled(qMax(1, previous.width() / 2), qMax(1, previous.height() / 2),
+                                         Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+    }
+    return m_mipmaps.at(level - 1);
+}
+
+const QPixmap &PixmapTexture::mirroredPixmap()
+{
+    if (m_mirroredPixmap.isNull() && !m_pixmap.isNull())
+        m_mirroredPixmap = m_pixmap.transformed(QTransform(-1, 0, 0, 1, 0, 0));
+    return m_mirroredPixmap;
+}
+
 void PixmapTexture::bind()
 {
     Q_UNREACHABLE();
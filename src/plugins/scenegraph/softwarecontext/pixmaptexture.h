@@ -45,10 +45,30 @@ public:
     bool hasMipmaps() const override;
     void bind() override;
 
+    QRectF normalizedTextureSubRect() const override;
+
     const QPixmap &pixmap() const { return m_pixmap; }
 
+    // Replaces the contents, of which only subRect is in use if it is valid.
+    // Wrappers around buffers that are repainted and resized in place use
+    // this instead of being recreated.
+    void setPixmap(const QPixmap &pixmap, const QRect &subRect = QRect());
+
+    // Level 0 is the pixmap itself, every further level halves the size of the
+    // previous one. Levels are built on first use and clamped to the smallest one.
+    const QPixmap &mipmapLevel(int level);
+
+    // Horizontally mirrored copy shared by all nodes showing this texture. It
+    // costs one extra copy of the image for the lifetime of the texture instead
+    // of one per mirrored node, and keeps drawing a plain blit, which is much
+    // faster than mirroring through a negative scale on every frame.
+    const QPixmap &mirroredPixmap();
+
 private:
     QPixmap m_pixmap;
+    QRect m_subRect;
+    QPixmap m_mirroredPixmap;
+    QVector<QPixmap> m_mipmaps;
 };
 
 #endif // PIXMAPTEXTURE_H
@@ -29,6 +29,7 @@
 
 #include "pluginmain.h"
 #include "context.h"
+#include "diskcache.h"
 #include "renderloop.h"
 #include "threadedrenderloop.h"
 
@@ -47,8 +48,10 @@ QStringList ContextPlugin::keys() const
 
 QSGContext *ContextPlugin::create(const QString &) const
 {
-    if (!instance)
+    if (!instance) {
+        SoftwareContext::DiskCache::load();
         instance = new SoftwareContext::Context();
+    }
     return instance;
 }
 
@@ -28,14 +28,200 @@
 ****************************************************************************/
 
 #include "rectanglenode.h"
+#include "diskcache.h"
+#include "pixmappool.h"
+#include "spanfiller.h"
 #include <qmath.h>
 
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <QtGui/QPainter>
 
+namespace SoftwareContext {
+
+inline uint qHash(const CornerPixmapKey &key, uint seed = 0)
+{
+    return ::qHash(key.radius, seed) ^ ::qHash(key.color) ^ ::qHash(key.penColor << 1)
+            ^ ::qHash(key.penWidth) ^ ::qHash(key.devicePixelRatio << 16) ^ uint(key.gradient);
+}
+
+static QPixmap renderCornerPixmap(const CornerPixmapKey &key)
+{
+    const int radius = key.radius;
+    QPixmap cornerPixmap(radius * 2 * key.devicePixelRatio, radius * 2 * key.devicePixelRatio);
+    cornerPixmap.setDevicePixelRatio(key.devicePixelRatio);
+    cornerPixmap.fill(Qt::transparent);
+
+    QPainter cornerPainter(&cornerPixmap);
+    cornerPainter.setRenderHint(QPainter::Antialiasing);
+    cornerPainter.setCompositionMode(QPainter::CompositionMode_Source);
+
+    //Paint outer cicle
+    if (key.penWidth > 0) {
+        cornerPainter.setPen(Qt::NoPen);
+        cornerPainter.setBrush(QColor::fromRgba(key.penColor));
+        cornerPainter.drawRoundedRect(QRectF(0, 0, radius * 2, radius *2), radius, radius);
+    }
+
+    //Paint inner circle
+    if (radius > key.penWidth) {
+        cornerPainter.setPen(Qt::NoPen);
+        if (!key.gradient)
+            cornerPainter.setBrush(QColor::fromRgba(key.color));
+        else
+            cornerPainter.setBrush(Qt::transparent);
+
+        QMarginsF adjustmentMargins(key.penWidth, key.penWidth, key.penWidth, key.penWidth);
+        QRectF cornerCircleRect = QRectF(0, 0, radius * 2, radius * 2).marginsRemoved(adjustmentMargins);
+        cornerPainter.drawRoundedRect(cornerCircleRect, radius, radius);
+    }
+    cornerPainter.end();
+
+    return cornerPixmap;
+}
+
+static QPixmap createCornerPixmap(const CornerPixmapKey &key)
+{
+    if (!DiskCache::isEnabled())
+        return renderCornerPixmap(key);
+
+    const QByteArray diskKey = "corner:" + QByteArray::number(key.radius) + ':' + QByteArray::number(key.color)
+            + ':' + QByteArray::number(key.penColor) + ':' + QByteArray::number(key.penWidth, 'g', 17)
+            + ':' + QByteArray::number(key.devicePixelRatio) + ':' + QByteArray::number(int(key.gradient));
+
+    QImage image;
+    if (DiskCache::find(diskKey, &image)) {
+        QPixmap cornerPixmap = QPixmap::fromImage(image);
+        cornerPixmap.setDevicePixelRatio(key.devicePixelRatio);
+        return cornerPixmap;
+    }
+
+    const QPixmap cornerPixmap = renderCornerPixmap(key);
+    DiskCache::insert(diskKey, cornerPixmap.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    return cornerPixmap;
+}
+
+// Identical rounded rectangles share their corner pixmaps. Entries are
+// reference counted by the nodes using them; unused entries are kept around
+// until the cache exceeds its byte limit.
+class CornerPixmapCache
+{
+public:
+    CornerPixmapCache() : m_bytes(0) {}
+
+    QPixmap acquire(const CornerPixmapKey &key, bool *shared);
+    void release(const CornerPixmapKey &key);
+
+private:
+    struct Entry
+    {
+        QPixmap pixmap;
+        int refCount;
+        qint64 bytes;
+    };
+
+    void trim(qint64 limit);
+
+    QMutex m_mutex;
+    QHash<CornerPixmapKey, Entry> m_entries;
+    qint64 m_bytes;
+};
+
+static const qint64 qsg_corner_cache_limit = 4 * 1024 * 1024;
+
+QPixmap CornerPixmapCache::acquire(const CornerPixmapKey &key, bool *shared)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QHash<CornerPixmapKey, Entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        ++it->refCount;
+        *shared = true;
+        return it->pixmap;
+    }
+
+    const QPixmap pixmap = createCornerPixmap(key);
+    const qint64 bytes = qint64(pixmap.width()) * pixmap.height() * 4;
+    if (m_bytes + bytes > qsg_corner_cache_limit)
+        trim(qsg_corner_cache_limit - bytes);
+    if (m_bytes + bytes > qsg_corner_cache_limit) {
+        *shared = false;
+        return pixmap;
+    }
+
+    Entry entry;
+    entry.pixmap = pixmap;
+    entry.refCount = 1;
+    entry.bytes = bytes;
+    m_entries.insert(key, entry);
+    m_bytes += bytes;
+    *shared = true;
+    return pixmap;
+}
+
+void CornerPixmapCache::release(const CornerPixmapKey &key)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QHash<CornerPixmapKey, Entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end() && it->refCount > 0)
+        --it->refCount;
+}
+
+void CornerPixmapCache::trim(qint64 limit)
+{
+    QHash<CornerPixmapKey, Entry>::iterator it = m_entries.begin();
+    while (it != m_entries.end() && m_bytes > limit) {
+        if (it->refCount == 0) {
+            m_bytes -= it->bytes;
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+Q_GLOBAL_STATIC(CornerPixmapCache, qsg_corner_pixmap_cache)
+
+// Vertical gradients are prerendered into one pixel wide strips, which are
+// then stretched horizontally. This avoids evaluating the gradient for every
+// span on every frame.
+struct GradientStripCache
+{
+    GradientStripCache() : strips(1024 * 1024) {}
+
+    QMutex mutex;
+    QCache<QByteArray, QPixmap> strips;
+};
+
+Q_GLOBAL_STATIC(GradientStripCache, qsg_gradient_strip_cache)
+
+static QByteArray gradientStripKey(const QGradientStops &stops, int height, int devicePixelRatio)
+{
+    QByteArray key;
+    key.reserve(2 * sizeof(int) + stops.size() * (sizeof(qreal) + sizeof(QRgb)));
+    key.append(reinterpret_cast<const char *>(&height), sizeof(int));
+    key.append(reinterpret_cast<const char *>(&devicePixelRatio), sizeof(int));
+    foreach (const QGradientStop &stop, stops) {
+        const QRgb color = stop.second.rgba();
+        key.append(reinterpret_cast<const char *>(&stop.first), sizeof(qreal));
+        key.append(reinterpret_cast<const char *>(&color), sizeof(QRgb));
+    }
+    return key;
+}
+
+}
+
 RectangleNode::RectangleNode()
     : m_penWidth(0)
     , m_radius(0)
-    , m_cornerPixmapIsDirty(true)
+    , m_pendingUpdate(DirtyRectGeometry | DirtyAppearance)
+    , m_cornerPixmapIsShared(false)
+    , m_rotatedPixmapIsDirty(true)
+    , m_roundedGradientStripKey(0)
+    , m_roundedGradientRadius(0)
+    , m_gradientRowsKey(0)
     , m_devicePixelRatio(1)
 {
     m_pen.setJoinStyle(Qt::MiterJoin);
@@ -44,12 +230,22 @@ RectangleNode::RectangleNode()
     setGeometry((QSGGeometry*)1);
 }
 
+RectangleNode::~RectangleNode()
+{
+    if (m_cornerPixmapIsShared && SoftwareContext::qsg_corner_pixmap_cache.exists())
+        SoftwareContext::qsg_corner_pixmap_cache()->release(m_cornerPixmapKey);
+}
+
 void RectangleNode::setRect(const QRectF &rect)
 {
     QRect alignedRect = rect.toAlignedRect();
     if (m_rect != alignedRect) {
+        //Radius and rotated raster depend on the size only
+        const DirtyFlags flags = alignedRect.size() == m_rect.size() ? DirtyRectGeometry
+                                                                      : DirtyRectGeometry | DirtyCorners;
         m_rect = alignedRect;
-        markDirty(DirtyMaterial);
+        m_pendingUpdate |= flags;
+        markDirty(DirtyGeometry);
     }
 }
 
@@ -57,7 +253,7 @@ void RectangleNode::setColor(const QColor &color)
 {
     if (m_color != color) {
         m_color = color;
-        m_cornerPixmapIsDirty = true;
+        m_pendingUpdate |= DirtyFill | DirtyCorners;
         markDirty(DirtyMaterial);
     }
 }
@@ -66,7 +262,7 @@ void RectangleNode::setPenColor(const QColor &color)
 {
     if (m_penColor != color) {
         m_penColor = color;
-        m_cornerPixmapIsDirty = true;
+        m_pendingUpdate |= DirtyBorder | DirtyCorners;
         markDirty(DirtyMaterial);
     }
 }
@@ -75,7 +271,7 @@ void RectangleNode::setPenWidth(qreal width)
 {
     if (m_penWidth != width) {
         m_penWidth = width;
-        m_cornerPixmapIsDirty = true;
+        m_pendingUpdate |= DirtyBorder | DirtyCorners;
         markDirty(DirtyMaterial);
     }
 }
@@ -170,7 +366,7 @@ void RectangleNode::setGradientStops(const QGradientStops &stops)
     } else {
         m_stops = stops;
     }
-    m_cornerPixmapIsDirty = true;
+    m_pendingUpdate |= DirtyFill | DirtyCorners;
     markDirty(DirtyMaterial);
 }
 
@@ -178,7 +374,7 @@ void RectangleNode::setRadius(qreal radius)
 {
     if (m_radius != radius) {
         m_radius = radius;
-        m_cornerPixmapIsDirty = true;
+        m_pendingUpdate |= DirtyCorners;
         markDirty(DirtyMaterial);
     }
 }
@@ -189,35 +385,51 @@ void RectangleNode::setAligned(bool /*aligned*/)
 
 void RectangleNode::update()
 {
-    if (!m_penWidth || m_penColor == Qt::transparent) {
-        m_pen = Qt::NoPen;
-    } else {
-        m_pen = QPen(m_penColor);
-        m_pen.setWidthF(m_penWidth);
+    if (m_pendingUpdate & DirtyBorder) {
+        if (!m_penWidth || m_penColor == Qt::transparent) {
+            m_pen = Qt::NoPen;
+        } else {
+            m_pen = QPen(m_penColor);
+            m_pen.setWidthF(m_penWidth);
+        }
     }
 
-    if (!m_stops.isEmpty()) {
-        QLinearGradient gradient(QPoint(0,0), QPoint(0,1));
-        gradient.setStops(m_stops);
-        gradient.setCoordinateMode(QGradient::ObjectBoundingMode);
-        m_brush = QBrush(gradient);
-    } else {
-        m_brush = QBrush(m_color);
+    if (m_pendingUpdate & DirtyFill) {
+        if (!m_stops.isEmpty()) {
+            QLinearGradient gradient(QPoint(0,0), QPoint(0,1));
+            gradient.setStops(m_stops);
+            gradient.setCoordinateMode(QGradient::ObjectBoundingMode);
+            m_brush = QBrush(gradient);
+        } else {
+            m_brush = QBrush(m_color);
+        }
     }
 
-    if (m_cornerPixmapIsDirty) {
+    if (m_pendingUpdate & DirtyCorners)
         generateCornerPixmap();
-        m_cornerPixmapIsDirty = false;
-    }
+
+    //The fill height changes with the size and the border
+    if (m_pendingUpdate & (DirtyFill | DirtyBorder | DirtyCorners))
+        updateGradientStrip();
+
+    //A pure move keeps the unrotated raster valid
+    if (m_pendingUpdate & DirtyAppearance)
+        m_rotatedPixmapIsDirty = true;
+
+    m_pendingUpdate = 0;
 }
 
-void RectangleNode::paint(QPainter *painter)
+void RectangleNode::paint(QPainter *painter, const SoftwareContext::DirectClip &clip)
 {
+    m_paintedRect = m_rect;
+
     //We can only check for a device pixel ratio change when we know what
     //paint device is being used.
     if (painter->device()->devicePixelRatio() != m_devicePixelRatio) {
         m_devicePixelRatio = painter->device()->devicePixelRatio();
         generateCornerPixmap();
+        updateGradientStrip();
+        m_rotatedPixmapIsDirty = true;
     }
 
     if (painter->transform().isRotating()) {
@@ -233,11 +445,24 @@ void RectangleNode::paint(QPainter *painter)
         } else {
             //Rounded Rects and Rects with Borders
             //Avoids broken behaviors of QPainter::drawRect/roundedRect
-            QPixmap pixmap = QPixmap(m_rect.width() * m_devicePixelRatio, m_rect.height() * m_devicePixelRatio);
-            pixmap.fill(Qt::transparent);
-            pixmap.setDevicePixelRatio(m_devicePixelRatio);
-            QPainter pixmapPainter(&pixmap);
-            paintRectangle(&pixmapPainter, QRect(0, 0, m_rect.width(), m_rect.height()));
+            //The unrotated raster is kept until the material or size changes,
+            //so rotation animations only pay for the transformed blit.
+            QPixmap pixmap = m_rotatedPixmap.pixmap();
+            if (m_rotatedPixmapIsDirty || pixmap.isNull()) {
+                //Give the previous raster back first, it often fits again
+                pixmap = QPixmap();
+                m_rotatedPixmap.clear();
+                pixmap = SoftwareContext::PixmapPool::acquire(QSize(m_rect.width() * m_devicePixelRatio,
+                                                                    m_rect.height() * m_devicePixelRatio));
+                pixmap.fill(Qt::transparent);
+                pixmap.setDevicePixelRatio(m_devicePixelRatio);
+                QPainter pixmapPainter(&pixmap);
+                paintRectangle(&pixmapPainter, QRect(0, 0, m_rect.width(), m_rect.height()));
+                pixmapPainter.end();
+
+                m_rotatedPixmap.setPixmap(pixmap);
+                m_rotatedPixmapIsDirty = false;
+            }
 
             QPainter::RenderHints previousRenderHints = painter->renderHints();
             painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
@@ -247,10 +472,53 @@ void RectangleNode::paint(QPainter *painter)
 
 
     } else {
-        //Paint directly
-        paintRectangle(painter, m_rect);
+        //The unrotated raster is only worth keeping while the rotation lasts
+        if (!m_rotatedPixmap.isNull())
+            m_rotatedPixmap.clear();
+
+        if (!paintSpans(painter, clip)) {
+            //Paint directly
+            paintRectangle(painter, m_rect);
+        }
+    }
+}
+
+bool RectangleNode::paintSpans(QPainter *painter, const SoftwareContext::DirectClip &clip)
+{
+    //Rasterize fill, border and corners in a single pass straight into the
+    //target image when the painter state allows it
+    if (m_devicePixelRatio != 1 || m_penWidth != qRound(m_penWidth))
+        return false;
+
+    SoftwareContext::DirectTarget target;
+    if (!SoftwareContext::directTarget(painter, clip, m_rect, &target))
+        return false;
+
+    const int radius = qFloor(qMin(qMin(m_rect.width(), m_rect.height()) * 0.5, m_radius));
+    if (radius <= 0 && (m_penWidth == 0 || m_penColor.alpha() == 0) && m_stops.isEmpty()) {
+        //Plain rects, the most common case, are straight scanline fills
+        const int penWidth = qRound(m_penWidth);
+        SoftwareContext::fillRect(target, m_rect.marginsRemoved(QMargins(penWidth, penWidth, penWidth, penWidth)),
+                                  qPremultiply(m_color.rgba()));
+        return true;
     }
 
+    const QRgb *fillRows = 0;
+    const int fillHeight = m_rect.height() - 2 * qRound(m_penWidth);
+    if (!m_stops.isEmpty() && fillHeight > 0) {
+        if (m_gradientStrip.cacheKey() != m_gradientRowsKey) {
+            const QImage rows = m_gradientStrip.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            m_gradientRows.resize(rows.height());
+            for (int y = 0; y < rows.height(); ++y)
+                m_gradientRows[y] = reinterpret_cast<const QRgb *>(rows.constScanLine(y))[0];
+            m_gradientRowsKey = m_gradientStrip.cacheKey();
+        }
+        fillRows = m_gradientRows.constData();
+    }
+
+    return SoftwareContext::fillRoundedRect(target, m_rect, radius, qRound(m_penWidth),
+                                            qPremultiply(m_penColor.rgba()),
+                                            qPremultiply(m_color.rgba()), fillRows);
 }
 
 void RectangleNode::paintRectangle(QPainter *painter, const QRect &rect)
@@ -362,11 +630,20 @@ void RectangleNode::paintRectangle(QPainter *painter, const QRect &rect)
                                  QPointF(brushRect.x() + brushRect.width(), brushRect.y() + brushRect.height() - innerRectRadius));
                 painter->fillRect(rightRect, m_color);
             } else {
-                //Rounded Rect with gradient (slow)
-                painter->setPen(Qt::NoPen);
-                painter->setBrush(m_brush);
-                painter->drawRoundedRect(brushRect, innerRectRadius, innerRectRadius);
+                //Rounded Rect with gradient, composed once from the gradient strip
+                const QPixmap &fill = roundedGradientPixmap(brushRect.size().toSize(), innerRectRadius);
+                if (!fill.isNull()) {
+                    painter->drawPixmap(brushRect.topLeft(), fill);
+                } else {
+                    painter->setPen(Qt::NoPen);
+                    painter->setBrush(m_brush);
+                    painter->drawRoundedRect(brushRect, innerRectRadius, innerRectRadius);
+                }
             }
+        } else if (!m_stops.empty() && !brushRect.isEmpty()) {
+            //Gradient rects are a horizontally stretched blit of the strip
+            painter->setRenderHint(QPainter::SmoothPixmapTransform, false);
+            painter->drawPixmap(brushRect, m_gradientStrip, m_gradientStrip.rect());
         } else {
             //non-rounded rects only need 1 blit
             painter->fillRect(brushRect, m_brush);
@@ -376,39 +653,97 @@ void RectangleNode::paintRectangle(QPainter *painter, const QRect &rect)
     painter->setRenderHints(previousRenderHints);
 }
 
-void RectangleNode::generateCornerPixmap()
+void RectangleNode::updateGradientStrip()
 {
-    //Generate new corner Pixmap
-    int radius = qFloor(qMin(qMin(m_rect.width(), m_rect.height()) * 0.5, m_radius));
+    if (m_stops.isEmpty()) {
+        m_gradientStrip = QPixmap();
+        return;
+    }
 
-    m_cornerPixmap = QPixmap(radius * 2 * m_devicePixelRatio, radius * 2 * m_devicePixelRatio);
-    m_cornerPixmap.setDevicePixelRatio(m_devicePixelRatio);
-    m_cornerPixmap.fill(Qt::transparent);
+    //One row per device pixel of the fill, inside the border
+    const int penWidth = qRound(m_penWidth);
+    const int height = qMax(0, m_rect.height() - 2 * penWidth) * m_devicePixelRatio;
 
-    if (radius > 0) {
-        QPainter cornerPainter(&m_cornerPixmap);
-        cornerPainter.setRenderHint(QPainter::Antialiasing);
-        cornerPainter.setCompositionMode(QPainter::CompositionMode_Source);
-
-        //Paint outer cicle
-        if (m_penWidth > 0) {
-            cornerPainter.setPen(Qt::NoPen);
-            cornerPainter.setBrush(m_penColor);
-            cornerPainter.drawRoundedRect(QRectF(0, 0, radius * 2, radius *2), radius, radius);
-        }
+    SoftwareContext::GradientStripCache *cache = SoftwareContext::qsg_gradient_strip_cache();
+    const QByteArray key = SoftwareContext::gradientStripKey(m_stops, height, m_devicePixelRatio);
 
-        //Paint inner circle
-        if (radius > m_penWidth) {
-            cornerPainter.setPen(Qt::NoPen);
-            if (m_stops.isEmpty())
-                cornerPainter.setBrush(m_brush);
-            else
-                cornerPainter.setBrush(Qt::transparent);
-
-            QMarginsF adjustmentMargins(m_penWidth, m_penWidth, m_penWidth, m_penWidth);
-            QRectF cornerCircleRect = QRectF(0, 0, radius * 2, radius * 2).marginsRemoved(adjustmentMargins);
-            cornerPainter.drawRoundedRect(cornerCircleRect, radius, radius);
-        }
-        cornerPainter.end();
+    QMutexLocker locker(&cache->mutex);
+    if (QPixmap *strip = cache->strips.object(key)) {
+        m_gradientStrip = *strip;
+        return;
     }
+
+    QPixmap *strip = new QPixmap(1, qMax(1, height));
+    strip->fill(Qt::transparent);
+    QPainter stripPainter(strip);
+    QLinearGradient gradient(QPoint(0, 0), QPoint(0, strip->height()));
+    gradient.setStops(m_stops);
+    stripPainter.setCompositionMode(QPainter::CompositionMode_Source);
+    stripPainter.fillRect(strip->rect(), gradient);
+    stripPainter.end();
+    strip->setDevicePixelRatio(m_devicePixelRatio);
+
+    m_gradientStrip = *strip;
+    cache->strips.insert(key, strip, strip->height() * 4);
+}
+
+const QPixmap &RectangleNode::roundedGradientPixmap(const QSize &size, double radius)
+{
+    const QSize deviceSize = size * m_devicePixelRatio;
+    const QPixmap &strip = m_gradientStrip;
+    if (!m_roundedGradientPixmap.isNull() && m_roundedGradientStripKey == strip.cacheKey()
+            && m_roundedGradientSize == size && m_roundedGradientRadius == radius) {
+        return m_roundedGradientPixmap.pixmap();
+    }
+
+    m_roundedGradientPixmap.clear();
+    m_roundedGradientStripKey = strip.cacheKey();
+    m_roundedGradientSize = size;
+    m_roundedGradientRadius = radius;
+    if (!SoftwareContext::CachedPixmap::fitsBudget(deviceSize))
+        return m_roundedGradientPixmap.pixmap();
+
+    QPixmap fill(deviceSize);
+    fill.fill(Qt::transparent);
+    fill.setDevicePixelRatio(m_devicePixelRatio);
+    QPainter fillPainter(&fill);
+    fillPainter.drawPixmap(QRectF(QPointF(0, 0), size), strip, strip.rect());
+
+    //Cut the corners with the anti-aliased coverage of the rounded rect
+    fillPainter.setRenderHint(QPainter::Antialiasing);
+    fillPainter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    fillPainter.setPen(Qt::NoPen);
+    fillPainter.setBrush(Qt::black);
+    fillPainter.drawRoundedRect(QRectF(QPointF(0, 0), size), radius, radius);
+    fillPainter.end();
+
+    m_roundedGradientPixmap.setPixmap(fill);
+    return m_roundedGradientPixmap.pixmap();
+}
+
+void RectangleNode::generateCornerPixmap()
+{
+    //Generate new corner Pixmap
+    int radius = qFloor(qMin(qMin(m_rect.width(), m_rect.height()) * 0.5, m_radius));
+
+    SoftwareContext::CornerPixmapKey key;
+    key.radius = radius;
+    key.color = m_color.rgba();
+    key.penColor = m_penColor.rgba();
+    key.penWidth = m_penWidth;
+    key.devicePixelRatio = m_devicePixelRatio;
+    key.gradient = !m_stops.isEmpty();
+
+    if (key == m_cornerPixmapKey && (radius <= 0 || !m_cornerPixmap.isNull()))
+        return;
+
+    if (m_cornerPixmapIsShared)
+        SoftwareContext::qsg_corner_pixmap_cache()->release(m_cornerPixmapKey);
+    m_cornerPixmapKey = key;
+    m_cornerPixmapIsShared = false;
+
+    if (radius > 0)
+        m_cornerPixmap = SoftwareContext::qsg_corner_pixmap_cache()->acquire(key, &m_cornerPixmapIsShared);
+    else
+        m_cornerPixmap = QPixmap();
 }
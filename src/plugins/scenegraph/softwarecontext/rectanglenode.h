@@ -36,10 +36,47 @@
 #include <QBrush>
 #include <QPixmap>
 
+#include "nodecache.h"
+#include "spanfiller.h"
+
+namespace SoftwareContext {
+
+struct CornerPixmapKey
+{
+    CornerPixmapKey()
+        : radius(0), color(0), penColor(0), penWidth(0), devicePixelRatio(1), gradient(false) {}
+
+    bool operator==(const CornerPixmapKey &other) const
+    {
+        return radius == other.radius && color == other.color && penColor == other.penColor
+                && penWidth == other.penWidth && devicePixelRatio == other.devicePixelRatio
+                && gradient == other.gradient;
+    }
+
+    int radius;
+    QRgb color;
+    QRgb penColor;
+    double penWidth;
+    int devicePixelRatio;
+    bool gradient;
+};
+
+}
+
 class RectangleNode : public QSGRectangleNode
 {
 public:
     RectangleNode();
+    ~RectangleNode();
+
+    enum DirtyFlag {
+        DirtyRectGeometry   = 0x01,
+        DirtyFill           = 0x02,
+        DirtyBorder         = 0x04,
+        DirtyCorners        = 0x08,
+        DirtyAppearance     = DirtyFill | DirtyBorder | DirtyCorners
+    };
+    Q_DECLARE_FLAGS(DirtyFlags, DirtyFlag)
 
     void setRect(const QRectF &rect) override;
     void setColor(const QColor &color) override;
@@ -52,13 +89,23 @@ public:
 
     void update() override;
 
-    void paint(QPainter *);
+    void paint(QPainter *painter, const SoftwareContext::DirectClip &clip);
+    QRectF rect() const { return m_rect; }
+
+    // What changed since the last update, rectangles that only moved or
+    // resized damage where they were painted and where they are now
+    DirtyFlags dirtyFlags() const { return m_pendingUpdate; }
+    QRectF paintedRect() const { return m_paintedRect; }
 
 private:
     void paintRectangle(QPainter *painter, const QRect &rect);
+    bool paintSpans(QPainter *painter, const SoftwareContext::DirectClip &clip);
     void generateCornerPixmap();
+    void updateGradientStrip();
+    const QPixmap &roundedGradientPixmap(const QSize &size, double radius);
 
     QRect m_rect;
+    QRect m_paintedRect;
     QColor m_color;
     QColor m_penColor;
     double m_penWidth;
@@ -67,10 +114,29 @@ private:
     QPen m_pen;
     QBrush m_brush;
 
-    bool m_cornerPixmapIsDirty;
+    // What update() has to rebuild; moves keep the brush, corners and
+    // rotated raster as they are
+    DirtyFlags m_pendingUpdate;
+
     QPixmap m_cornerPixmap;
+    SoftwareContext::CornerPixmapKey m_cornerPixmapKey;
+    bool m_cornerPixmapIsShared;
+
+    SoftwareContext::CachedPixmap m_rotatedPixmap;
+    bool m_rotatedPixmapIsDirty;
+
+    SoftwareContext::CachedPixmap m_roundedGradientPixmap;
+    qint64 m_roundedGradientStripKey;
+    QSize m_roundedGradientSize;
+    double m_roundedGradientRadius;
+
+    QPixmap m_gradientStrip;
+    QVector<QRgb> m_gradientRows;
+    qint64 m_gradientRowsKey;
 
     int m_devicePixelRatio;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(RectangleNode::DirtyFlags)
+
 #endif // RECTANGLENODE_H
@@ -35,6 +35,7 @@
 #include "ninepatchnode.h"
 #include "painternode.h"
 #include "pixmaptexture.h"
+#include "spanfiller.h"
 
 #include <QtQuick/QSGSimpleRectNode>
 #include <QtQuick/qsgsimpletexturenode.h>
@@ -44,7 +45,7 @@
 RenderingVisitor::RenderingVisitor(QPainter *painter)
     : painter(painter)
 {
-
+    clips.append(SoftwareContext::DirectClip::fromPainter(painter));
 }
 
 bool RenderingVisitor::visit(QSGTransformNode *node)
@@ -63,17 +64,28 @@ bool RenderingVisitor::visit(QSGClipNode *node)
 {
     painter->save();
     painter->setClipRect(node->clipRect(), Qt::IntersectClip);
+    clips.append(clips.last().intersected(painter, node->clipRect()));
     return true;
 }
 
 void RenderingVisitor::endVisit(QSGClipNode *)
 {
+    clips.removeLast();
     painter->restore();
 }
 
 bool RenderingVisitor::visit(QSGGeometryNode *node)
 {
     if (QSGSimpleRectNode *rectNode = dynamic_cast<QSGSimpleRectNode *>(node)) {
+        //Opaque, pixel aligned rects are written straight into the target
+        const QRectF rect = rectNode->rect();
+        SoftwareContext::DirectTarget target;
+        if (rectNode->color().alpha() == 255 && rect == QRectF(rect.toRect())
+                && SoftwareContext::directTarget(painter, clips.last(), rect.toRect(), &target)) {
+            SoftwareContext::fillRect(target, rect.toRect(), rectNode->color().rgba());
+            return true;
+        }
+
         if (!(rectNode->material()->flags() & QSGMaterial::Blending))
             painter->setCompositionMode(QPainter::CompositionMode_Source);
         painter->fillRect(rectNode->rect(), rectNode->color());
@@ -82,10 +94,14 @@ bool RenderingVisitor::visit(QSGGeometryNode *node)
         QSGTexture *texture = tn->texture();
         if (PixmapTexture *pt = dynamic_cast<PixmapTexture *>(texture)) {
             const QPixmap &pm = pt->pixmap();
+            //The texture may only be part of the pixmap, source rects are relative to it
+            const QRectF subRect = pt->normalizedTextureSubRect();
+            const QRectF textureRect(subRect.x() * pm.width(), subRect.y() * pm.height(),
+                                     subRect.width() * pm.width(), subRect.height() * pm.height());
 #if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
-            painter->drawPixmap(tn->rect(), pm, tn->sourceRect());
+            painter->drawPixmap(tn->rect(), pm, tn->sourceRect().translated(textureRect.topLeft()));
 #else
-            painter->drawPixmap(tn->rect(), pm, QRectF(0, 0, pm.width(), pm.height()));
+            painter->drawPixmap(tn->rect(), pm, textureRect);
 #endif
         } else if (QSGPlainTexture *pt = dynamic_cast<QSGPlainTexture *>(texture)) {
             const QImage &im = pt->image();
@@ -134,7 +150,7 @@ void RenderingVisitor::endVisit(QSGImageNode *)
 
 bool RenderingVisitor::visit(QSGPainterNode *node)
 {
-    static_cast<PainterNode*>(node)->paint(painter);
+    static_cast<PainterNode*>(node)->paint(painter, clips.last());
     return true;
 }
 
@@ -144,7 +160,7 @@ void RenderingVisitor::endVisit(QSGPainterNode *)
 
 bool RenderingVisitor::visit(QSGRectangleNode *node)
 {
-    static_cast<RectangleNode*>(node)->paint(painter);
+    static_cast<RectangleNode*>(node)->paint(painter, clips.last());
     return true;
 }
 
@@ -154,7 +170,7 @@ void RenderingVisitor::endVisit(QSGRectangleNode *)
 
 bool RenderingVisitor::visit(QSGGlyphNode *node)
 {
-    static_cast<GlyphNode*>(node)->paint(painter);
+    static_cast<GlyphNode*>(node)->paint(painter, clips.last());
     return true;
 }
 
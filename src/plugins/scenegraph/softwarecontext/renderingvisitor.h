@@ -32,6 +32,8 @@
 
 #include <private/qsgadaptationlayer_p.h>
 
+#include "spanfiller.h"
+
 class RenderingVisitor : public QSGNodeVisitorEx
 {
 public:
@@ -60,6 +62,8 @@ public:
 
 private:
     QPainter *painter;
+    // Device clip of each entered clip node, the painter's own clip first
+    QVector<SoftwareContext::DirectClip> clips;
 };
 
 #endif // RENDERINGVISITOR_H
@@ -30,6 +30,7 @@
 #include "renderloop.h"
 
 #include "context.h"
+#include "painternode.h"
 
 #include <QtCore/QCoreApplication>
 
@@ -118,6 +119,7 @@ void RenderLoop::renderWindow(QQuickWindow *window)
     emit window->afterAnimating();
 
     cd->syncSceneGraph();
+    PainterNode::finishThreadedPainting(ctx);
 
     if (profileFrames)
         syncTime = renderTimer.nsecsElapsed();
@@ -165,6 +167,9 @@ void RenderLoop::renderWindow(QQuickWindow *window)
 void RenderLoop::exposureChanged(QQuickWindow *window)
 {
     if (window->isExposed()) {
+        QQuickWindowPrivate *cd = QQuickWindowPrivate::get(window);
+        if (cd->renderer)
+            static_cast<SoftwareContext::Renderer*>(cd->renderer)->markFullRepaint();
         m_windows[window].updatePending = true;
         renderWindow(window);
     }
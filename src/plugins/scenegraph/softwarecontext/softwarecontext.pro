@@ -21,7 +21,12 @@ SOURCES += \
     ninepatchnode.cpp \
     softwarelayer.cpp \
     threadedrenderloop.cpp \
-    painternode.cpp
+    painternode.cpp \
+    nodecache.cpp \
+    spanfiller.cpp \
+    glyphcache.cpp \
+    diskcache.cpp \
+    pixmappool.cpp
 
 HEADERS += \
     context.h \
@@ -35,7 +40,12 @@ HEADERS += \
     ninepatchnode.h \
     softwarelayer.h \
     threadedrenderloop.h \
-    painternode.h
+    painternode.h \
+    nodecache.h \
+    spanfiller.h \
+    glyphcache.h \
+    diskcache.h \
+    pixmappool.h
 
 OTHER_FILES += softwarecontext.json
 
@@ -30,6 +30,20 @@
 #include "softwarelayer.h"
 
 #include "context.h"
+#include "pixmappool.h"
+
+#include <QtCore/QElapsedTimer>
+
+// Recursive layers update at most at QSG_RASTER_RECURSIVE_LAYER_FPS frames
+// per second, 0 updates them as fast as they render
+static int qsg_recursive_layer_interval()
+{
+    bool ok = false;
+    const int fps = qgetenv("QSG_RASTER_RECURSIVE_LAYER_FPS").toInt(&ok);
+    if (!ok)
+        return 1000 / 60;
+    return fps > 0 ? qMax(1, 1000 / fps) : 0;
+}
 
 SoftwareLayer::SoftwareLayer(QSGRenderContext *renderContext)
     : m_item(0)
@@ -43,7 +57,8 @@ SoftwareLayer::SoftwareLayer(QSGRenderContext *renderContext)
     , m_recursive(false)
     , m_dirtyTexture(true)
 {
-
+    m_recursiveUpdateTimer.setSingleShot(true);
+    connect(&m_recursiveUpdateTimer, SIGNAL(timeout()), this, SLOT(markDirtyTexture()));
 }
 
 SoftwareLayer::~SoftwareLayer()
@@ -92,8 +107,10 @@ void SoftwareLayer::setItem(QSGNode *item)
         return;
     m_item = item;
 
-    if (m_live && !m_item)
+    if (m_live && !m_item) {
         m_pixmap = QPixmap();
+        m_backPixmap = QPixmap();
+    }
 
     markDirtyTexture();
 }
@@ -112,8 +129,10 @@ void SoftwareLayer::setSize(const QSize &size)
         return;
     m_size = size;
 
-    if (m_live && m_size.isNull())
+    if (m_live && m_size.isNull()) {
         m_pixmap = QPixmap();
+        m_backPixmap = QPixmap();
+    }
 
     markDirtyTexture();
 }
@@ -139,8 +158,10 @@ void SoftwareLayer::setLive(bool live)
         return;
     m_live = live;
 
-    if (m_live && (!m_item || m_size.isNull()))
+    if (m_live && (!m_item || m_size.isNull())) {
         m_pixmap = QPixmap();
+        m_backPixmap = QPixmap();
+    }
 
     markDirtyTexture();
 }
@@ -148,6 +169,10 @@ void SoftwareLayer::setLive(bool live)
 void SoftwareLayer::setRecursive(bool recursive)
 {
     m_recursive = recursive;
+    if (!m_recursive) {
+        m_recursiveUpdateTimer.stop();
+        m_backPixmap = QPixmap();
+    }
 }
 
 void SoftwareLayer::setFormat(GLenum)
@@ -193,10 +218,20 @@ void SoftwareLayer::invalidated()
     m_renderer = 0;
 }
 
+void SoftwareLayer::subtreeChanged()
+{
+    //A recursive layer sees its own new frame as a change of its subtree,
+    //the pending timer renders everything that changed in the meantime
+    if (m_recursive && m_recursiveUpdateTimer.isActive())
+        return;
+    markDirtyTexture();
+}
+
 void SoftwareLayer::grab()
 {
     if (!m_item || m_size.isNull()) {
         m_pixmap = QPixmap();
+        m_backPixmap = QPixmap();
         m_dirtyTexture = false;
         return;
     }
@@ -206,21 +241,40 @@ void SoftwareLayer::grab()
     if (root->type() != QSGNode::RootNodeType)
         return;
 
+    QElapsedTimer grabTimer;
+    grabTimer.start();
+
     if (!m_renderer) {
         m_renderer = new SoftwareContext::PixmapRenderer(m_context);
-        connect(m_renderer, SIGNAL(sceneGraphChanged()), this, SLOT(markDirtyTexture()));
+        connect(m_renderer, SIGNAL(sceneGraphChanged()), this, SLOT(subtreeChanged()));
     }
+    if (m_renderer->rootNode() != root || m_renderer->devicePixelRatio() != m_device_pixel_ratio)
+        m_renderer->markFullRepaint();
     m_renderer->setDevicePixelRatio(m_device_pixel_ratio);
     m_renderer->setRootNode(static_cast<QSGRootNode *>(root));
 
     if (m_pixmap.size() != m_size) {
-        m_pixmap = QPixmap(m_size);
+        m_pixmap = QPixmap();
+        m_pixmap = SoftwareContext::PixmapPool::acquire(m_size);
         m_pixmap.setDevicePixelRatio(m_device_pixel_ratio);
+        //Sampled by the subtree of a recursive layer before its first frame
+        if (m_recursive)
+            m_pixmap.fill(Qt::transparent);
+        m_renderer->markFullRepaint();
     }
 
-    // Render texture.
-    root->markDirty(QSGNode::DirtyForceUpdate); // Force matrix, clip and opacity update.
-    m_renderer->nodeChanged(root, QSGNode::DirtyForceUpdate); // Force render list update.
+    // Render texture. Only what changed since the last grab is rendered again,
+    // recursive layers render a whole new frame into their back buffer.
+    QPixmap *target = &m_pixmap;
+    if (m_recursive) {
+        if (m_backPixmap.size() != m_size) {
+            m_backPixmap = QPixmap();
+            m_backPixmap = SoftwareContext::PixmapPool::acquire(m_size);
+            m_backPixmap.setDevicePixelRatio(m_device_pixel_ratio);
+        }
+        target = &m_backPixmap;
+        m_renderer->markFullRepaint();
+    }
 
     m_dirtyTexture = false;
 
@@ -234,10 +288,21 @@ void SoftwareLayer::grab()
     m_renderer->setClearColor(Qt::transparent);
 
     m_renderer->renderScene();
-    m_renderer->render(&m_pixmap);
-
-    root->markDirty(QSGNode::DirtyForceUpdate); // Force matrix, clip, opacity and render list update.
-
+    m_renderer->render(target);
     if (m_recursive)
-        markDirtyTexture(); // Continuously update if 'live' and 'recursive'.
+        m_pixmap.swap(m_backPixmap);
+
+    // Force matrix, clip, opacity and render list update. Only renderers of
+    // enclosing layers are notified, which ignore forced updates.
+    root->markDirty(QSGNode::DirtyForceUpdate);
+
+    // Continuously update if 'live' and 'recursive', without going over the
+    // recursive frame rate.
+    if (m_recursive) {
+        static const int interval = qsg_recursive_layer_interval();
+        if (interval == 0)
+            markDirtyTexture();
+        else if (!m_recursiveUpdateTimer.isActive())
+            m_recursiveUpdateTimer.start(qMax(0, interval - int(grabTimer.elapsed())));
+    }
 }
@@ -32,6 +32,7 @@
 
 #include <private/qsgadaptationlayer_p.h>
 #include <private/qsgcontext_p.h>
+#include <QtCore/QTimer>
 
 namespace SoftwareContext {
 class PixmapRenderer;
@@ -77,6 +78,9 @@ public slots:
     void markDirtyTexture() override;
     void invalidated() override;
 
+private slots:
+    void subtreeChanged();
+
 private:
     void grab();
 
@@ -86,6 +90,10 @@ private:
     QRectF m_rect;
     QSize m_size;
     QPixmap m_pixmap;
+    // Recursive layers render into the back buffer while their subtree
+    // samples the previous frame from m_pixmap, then the two are swapped
+    QPixmap m_backPixmap;
+    QTimer m_recursiveUpdateTimer;
     qreal m_device_pixel_ratio;
     bool m_mirrorHorizontal;
     bool m_mirrorVertical;
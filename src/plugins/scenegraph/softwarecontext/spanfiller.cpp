@@ -0,0 +1,488 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "spanfiller.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEngine>
+#include <qpa/qplatformpixmap.h>
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define QSG_RASTER_NEON
+#endif
+
+namespace SoftwareContext {
+
+static inline uint byteMul(uint x, uint a)
+{
+    uint t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+static inline uint sourceOver(uint dst, uint src)
+{
+    return src + byteMul(dst, 255 - qAlpha(src));
+}
+
+static void fillSpan(quint32 *dst, int count, quint32 color)
+{
+#if defined(__SSE2__)
+    const __m128i c = _mm_set1_epi32(color);
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), c);
+#elif defined(QSG_RASTER_NEON)
+    const uint32x4_t c = vdupq_n_u32(color);
+    for (; count >= 4; count -= 4, dst += 4)
+        vst1q_u32(dst, c);
+#endif
+    for (; count > 0; --count)
+        *dst++ = color;
+}
+
+// SourceOver of a constant premultiplied color: dst = color + dst * (255 - alpha) / 255
+static void blendSpan(quint32 *dst, int count, quint32 color)
+{
+    const uint ialpha = 255 - qAlpha(color);
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_set1_epi32(color);
+    const __m128i ia = _mm_set1_epi16(short(ialpha));
+    const __m128i half = _mm_set1_epi16(0x80);
+    for (; count >= 4; count -= 4, dst += 4) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia), half);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia), half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_add_epi8(_mm_packus_epi16(lo, hi), c));
+    }
+#elif defined(QSG_RASTER_NEON)
+    const uint8x8_t ia = vdup_n_u8(uint8_t(ialpha));
+    const uint32x4_t c = vdupq_n_u32(color);
+    for (; count >= 4; count -= 4, dst += 4) {
+        const uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst));
+        const uint16x8_t lo = vmull_u8(vget_low_u8(d), ia);
+        const uint16x8_t hi = vmull_u8(vget_high_u8(d), ia);
+        const uint8x16_t r = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                                         vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+        vst1q_u32(dst, vaddq_u32(vreinterpretq_u32_u8(r), c));
+    }
+#endif
+    for (; count > 0; --count, ++dst)
+        *dst = color + byteMul(*dst, ialpha);
+}
+
+#if defined(__SSE2__)
+static inline __m128i byteMul16(__m128i x, __m128i a)
+{
+    const __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i blendMask16(__m128i dst, __m128i color, __m128i coverage)
+{
+    const __m128i src = byteMul16(color, coverage);
+    __m128i alpha = _mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_add_epi16(src, byteMul16(dst, _mm_sub_epi16(_mm_set1_epi16(0xff), alpha)));
+}
+#endif
+
+// SourceOver of a constant premultiplied color scaled by per pixel coverage
+static void blendMaskSpan(quint32 *dst, const uchar *coverage, int count, quint32 color)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+    for (; count >= 4; count -= 4, dst += 4, coverage += 4) {
+        quint32 coverage4;
+        memcpy(&coverage4, coverage, sizeof(coverage4));
+        if (!coverage4)
+            continue;
+        __m128i cov = _mm_unpacklo_epi8(_mm_cvtsi32_si128(coverage4), zero);
+        cov = _mm_unpacklo_epi16(cov, cov);
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+        const __m128i lo = blendMask16(_mm_unpacklo_epi8(d, zero), c, _mm_unpacklo_epi32(cov, cov));
+        const __m128i hi = blendMask16(_mm_unpackhi_epi8(d, zero), c, _mm_unpackhi_epi32(cov, cov));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(QSG_RASTER_NEON)
+    static const uint8_t expandLow[8] = { 0, 0, 0, 0, 1, 1, 1, 1 };
+    static const uint8_t expandHigh[8] = { 2, 2, 2, 2, 3, 3, 3, 3 };
+    static const uint8_t alphas[8] = { 3, 3, 3, 3, 7, 7, 7, 7 };
+    const uint8x8_t lowIndex = vld1_u8(expandLow);
+    const uint8x8_t highIndex = vld1_u8(expandHigh);
+    const uint8x8_t alphaIndex = vld1_u8(alphas);
+    const uint8x8_t c = vreinterpret_u8_u32(vdup_n_u32(color));
+    for (; count >= 4; count -= 4, dst += 4, coverage += 4) {
+        quint32 coverage4;
+        memcpy(&coverage4, coverage, sizeof(coverage4));
+        if (!coverage4)
+            continue;
+        const uint8x8_t cov = vreinterpret_u8_u32(vdup_n_u32(coverage4));
+        const uint16x8_t sl = vmull_u8(c, vtbl1_u8(cov, lowIndex));
+        const uint16x8_t sh = vmull_u8(c, vtbl1_u8(cov, highIndex));
+        const uint8x8_t srcLow = vraddhn_u16(sl, vrshrq_n_u16(sl, 8));
+        const uint8x8_t srcHigh = vraddhn_u16(sh, vrshrq_n_u16(sh, 8));
+        const uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst));
+        const uint16x8_t dl = vmull_u8(vget_low_u8(d), vmvn_u8(vtbl1_u8(srcLow, alphaIndex)));
+        const uint16x8_t dh = vmull_u8(vget_high_u8(d), vmvn_u8(vtbl1_u8(srcHigh, alphaIndex)));
+        const uint8x16_t r = vcombine_u8(vadd_u8(srcLow, vraddhn_u16(dl, vrshrq_n_u16(dl, 8))),
+                                         vadd_u8(srcHigh, vraddhn_u16(dh, vrshrq_n_u16(dh, 8))));
+        vst1q_u32(dst, vreinterpretq_u32_u8(r));
+    }
+#endif
+    for (; count > 0; --count, ++dst, ++coverage) {
+        if (*coverage)
+            *dst = sourceOver(*dst, byteMul(color, *coverage));
+    }
+}
+
+// Coverage of the pixels in a top left corner of the given radius, sampled
+// on an 8x8 grid per pixel. Tables are shared by all rectangles.
+static const int maximumTableRadius = 256;
+
+struct CoverageTables
+{
+    QMutex mutex;
+    QHash<int, QByteArray> tables;
+};
+
+Q_GLOBAL_STATIC(CoverageTables, qsg_coverage_tables)
+
+static QByteArray coverageTable(int radius)
+{
+    CoverageTables *tables = qsg_coverage_tables();
+    QMutexLocker locker(&tables->mutex);
+
+    QHash<int, QByteArray>::const_iterator it = tables->tables.constFind(radius);
+    if (it != tables->tables.constEnd())
+        return it.value();
+
+    QByteArray table(radius * radius, Qt::Uninitialized);
+    uchar *coverage = reinterpret_cast<uchar *>(table.data());
+    const qreal radiusSquared = qreal(radius) * radius;
+    for (int j = 0; j < radius; ++j) {
+        for (int i = 0; i < radius; ++i) {
+            int samples = 0;
+            for (int sy = 0; sy < 8; ++sy) {
+                const qreal dy = radius - (j + (sy + 0.5) / 8);
+                for (int sx = 0; sx < 8; ++sx) {
+                    const qreal dx = radius - (i + (sx + 0.5) / 8);
+                    if (dx * dx + dy * dy <= radiusSquared)
+                        ++samples;
+                }
+            }
+            coverage[j * radius + i] = uchar((samples * 255 + 32) / 64);
+        }
+    }
+
+    tables->tables.insert(radius, table);
+    return table;
+}
+
+namespace {
+
+struct Shape
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+    int radius;
+    const uchar *table;
+
+    bool isEmpty() const { return right < left || bottom < top; }
+    bool containsRow(int y) const { return y >= top && y <= bottom; }
+
+    int cornerWidth(int y) const
+    {
+        return (y < top + radius || y > bottom - radius) ? radius : 0;
+    }
+
+    int coverage(int x, int y) const
+    {
+        if (x < left || x > right || y < top || y > bottom)
+            return 0;
+        int i = x - left;
+        if (i >= radius)
+            i = right - x;
+        int j = y - top;
+        if (j >= radius)
+            j = bottom - y;
+        if (i >= radius || j >= radius)
+            return 255;
+        return table[j * radius + i];
+    }
+};
+
+}
+
+static QImage *rasterBuffer(QPaintDevice *device)
+{
+    if (device->devType() == QInternal::Image)
+        return static_cast<QImage *>(device);
+    if (device->devType() == QInternal::Pixmap) {
+        QPlatformPixmap *data = static_cast<QPixmap *>(device)->handle();
+        if (data && data->classId() == QPlatformPixmap::RasterClass)
+            return data->buffer();
+    }
+    return 0;
+}
+
+DirectClip DirectClip::fromPainter(QPainter *painter)
+{
+    DirectClip clip;
+    if (!painter->hasClipping())
+        return clip;
+
+    clip.clipped = true;
+    const QTransform transform = painter->combinedTransform();
+    if (transform.type() > QTransform::TxTranslate
+            || transform.dx() != qRound(transform.dx()) || transform.dy() != qRound(transform.dy())) {
+        clip.complex = true;
+        return clip;
+    }
+    clip.rects = painter->clipRegion().translated(qRound(transform.dx()), qRound(transform.dy())).rects();
+    return clip;
+}
+
+DirectClip DirectClip::intersected(QPainter *painter, const QRectF &rect) const
+{
+    DirectClip clip = *this;
+    if (clip.complex)
+        return clip;
+
+    const QTransform transform = painter->combinedTransform();
+    const QRectF mapped = transform.mapRect(rect);
+    const QRect aligned = mapped.toRect();
+    if (transform.type() > QTransform::TxScale || QRectF(aligned) != mapped) {
+        clip.complex = true;
+        return clip;
+    }
+
+    if (!clip.clipped) {
+        clip.clipped = true;
+        clip.rects.append(aligned);
+        return clip;
+    }
+
+    QVector<QRect> rects;
+    foreach (const QRect &clipRect, clip.rects) {
+        const QRect intersection = clipRect & aligned;
+        if (!intersection.isEmpty())
+            rects.append(intersection);
+    }
+    clip.rects = rects;
+    return clip;
+}
+
+bool directTarget(QPainter *painter, const DirectClip &clip, const QRect &bounds, DirectTarget *target)
+{
+    if (clip.complex)
+        return false;
+
+    if (painter->paintEngine()->type() != QPaintEngine::Raster
+            || painter->compositionMode() != QPainter::CompositionMode_SourceOver)
+        return false;
+
+    const QTransform transform = painter->combinedTransform();
+    if (transform.type() > QTransform::TxTranslate
+            || transform.dx() != qRound(transform.dx()) || transform.dy() != qRound(transform.dy()))
+        return false;
+
+    QImage *image = rasterBuffer(painter->device());
+    if (!image || image->devicePixelRatio() != 1
+            || (image->format() != QImage::Format_ARGB32_Premultiplied && image->format() != QImage::Format_RGB32))
+        return false;
+
+    target->image = image;
+    target->offset = QPoint(qRound(transform.dx()), qRound(transform.dy()));
+    target->clipRect = image->rect();
+    target->opacity = qRound(painter->opacity() * 255);
+
+    if (clip.clipped) {
+        //Only one rect of the clip may be touched, an empty clip rect draws nothing
+        const QRect deviceBounds = bounds.translated(target->offset);
+        QRect clipRect;
+        foreach (const QRect &rect, clip.rects) {
+            if (!rect.intersects(deviceBounds))
+                continue;
+            if (!clipRect.isNull())
+                return false;
+            clipRect = rect;
+        }
+        target->clipRect &= clipRect;
+    }
+    return true;
+}
+
+void fillRect(const DirectTarget &target, const QRect &rect, QRgb color)
+{
+    const QRect bounds = rect.translated(target.offset) & target.clipRect;
+    color = byteMul(color, target.opacity);
+    if (bounds.isEmpty() || !color)
+        return;
+
+    uchar *bits = target.image->bits();
+    const int bytesPerLine = target.image->bytesPerLine();
+    const bool opaque = qAlpha(color) == 255;
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        quint32 *line = reinterpret_cast<quint32 *>(bits + y * bytesPerLine) + bounds.left();
+        if (opaque)
+            fillSpan(line, bounds.width(), color);
+        else
+            blendSpan(line, bounds.width(), color);
+    }
+}
+
+bool fillRoundedRect(const DirectTarget &target, const QRect &rect, int radius, int borderWidth,
+                     QRgb borderColor, QRgb fillColor, const QRgb *fillRows)
+{
+    const QRect deviceRect = rect.translated(target.offset);
+    radius = qBound(0, radius, qMin(deviceRect.width(), deviceRect.height()) / 2);
+    if (radius > maximumTableRadius)
+        return false;
+
+    const QRect bounds = deviceRect & target.clipRect;
+    if (bounds.isEmpty() || target.opacity == 0)
+        return true;
+
+    borderWidth = qMax(0, borderWidth);
+    const int innerRadius = qMax(0, radius - borderWidth);
+    const QByteArray outerTable = radius > 0 ? coverageTable(radius) : QByteArray();
+    const QByteArray innerTable = innerRadius > 0 ? coverageTable(innerRadius) : QByteArray();
+
+    const Shape outer = { deviceRect.left(), deviceRect.top(), deviceRect.right(), deviceRect.bottom(),
+                          radius, reinterpret_cast<const uchar *>(outerTable.constData()) };
+    const Shape inner = { outer.left + borderWidth, outer.top + borderWidth,
+                          outer.right - borderWidth, outer.bottom - borderWidth,
+                          innerRadius, reinterpret_cast<const uchar *>(innerTable.constData()) };
+
+    const quint32 border = byteMul(borderColor, target.opacity);
+    const quint32 fill = byteMul(fillColor, target.opacity);
+
+    uchar *bits = target.image->bits();
+    const int bytesPerLine = target.image->bytesPerLine();
+
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        quint32 *line = reinterpret_cast<quint32 *>(bits + y * bytesPerLine);
+
+        const bool rowHasInner = !inner.isEmpty() && inner.containsRow(y);
+        const quint32 rowFill = fillRows && rowHasInner ? byteMul(fillRows[y - inner.top], target.opacity) : fill;
+
+        // Pixels within 'edge' of either side need per pixel coverage, the
+        // run in between is a solid span of either fill or border.
+        const int edge = rowHasInner ? qMax(outer.cornerWidth(y), borderWidth + inner.cornerWidth(y))
+                                     : outer.cornerWidth(y);
+        const int leftEnd = qMin(outer.left + edge, outer.right + 1);
+        const int rightStart = qMax(outer.right - edge + 1, leftEnd);
+
+        for (int pass = 0; pass < 2; ++pass) {
+            const int from = qMax(pass ? rightStart : outer.left, bounds.left());
+            const int to = qMin(pass ? outer.right : leftEnd - 1, bounds.right());
+            for (int x = from; x <= to; ++x) {
+                const int outerCoverage = outer.coverage(x, y);
+                const int innerCoverage = rowHasInner ? qMin(inner.coverage(x, y), outerCoverage) : 0;
+                const uint src = byteMul(border, outerCoverage - innerCoverage) + byteMul(rowFill, innerCoverage);
+                if (src)
+                    line[x] = sourceOver(line[x], src);
+            }
+        }
+
+        const quint32 runColor = rowHasInner ? rowFill : border;
+        const int runLeft = qMax(leftEnd, bounds.left());
+        const int runRight = qMin(rightStart - 1, bounds.right());
+        if (runRight < runLeft || !runColor)
+            continue;
+        if (qAlpha(runColor) == 255)
+            fillSpan(line + runLeft, runRight - runLeft + 1, runColor);
+        else
+            blendSpan(line + runLeft, runRight - runLeft + 1, runColor);
+    }
+    return true;
+}
+
+bool blitOpaque(const DirectTarget &target, const QPoint &pos, const QPixmap &pixmap, const QRect &sourceRect)
+{
+    const QImage *source = pixmap.isNull() ? 0 : rasterBuffer(const_cast<QPixmap *>(&pixmap));
+    if (!source || source->format() != QImage::Format_RGB32 || source->devicePixelRatio() != 1
+            || target.opacity != 255)
+        return false;
+
+    const QRect sourceBounds = sourceRect & source->rect();
+    const QPoint delta = pos + target.offset - sourceRect.topLeft();
+    const QRect bounds = sourceBounds.translated(delta) & target.clipRect;
+    if (bounds.isEmpty())
+        return true;
+
+    //RGB32 pixels have an opaque alpha byte, so they are valid premultiplied pixels too
+    uchar *bits = target.image->bits();
+    const int bytesPerLine = target.image->bytesPerLine();
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        const uchar *line = source->constScanLine(y - delta.y()) + (bounds.left() - delta.x()) * 4;
+        memcpy(bits + y * bytesPerLine + bounds.left() * 4, line, bounds.width() * 4);
+    }
+    return true;
+}
+
+void blendMask(const DirectTarget &target, const QPoint &pos, const QImage &mask, QRgb color)
+{
+    Q_ASSERT(mask.format() == QImage::Format_Alpha8);
+
+    const QRect deviceRect(pos + target.offset, mask.size());
+    const QRect bounds = deviceRect & target.clipRect;
+    color = byteMul(color, target.opacity);
+    if (bounds.isEmpty() || !color)
+        return;
+
+    uchar *bits = target.image->bits();
+    const int bytesPerLine = target.image->bytesPerLine();
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        quint32 *line = reinterpret_cast<quint32 *>(bits + y * bytesPerLine) + bounds.left();
+        const uchar *coverage = mask.constScanLine(y - deviceRect.top()) + bounds.left() - deviceRect.left();
+        blendMaskSpan(line, coverage, bounds.width(), color);
+    }
+}
+
+} // namespace
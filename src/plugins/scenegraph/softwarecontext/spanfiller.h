@@ -0,0 +1,92 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick 2D Renderer module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 or (at your option) any later version
+** approved by the KDE Free Qt Foundation. The licenses are as published by
+** the Free Software Foundation and appearing in the file LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef SPANFILLER_H
+#define SPANFILLER_H
+
+#include <QtCore/QVector>
+#include <QtGui/QImage>
+
+class QPainter;
+class QPixmap;
+
+namespace SoftwareContext {
+
+// A raster image that nodes can write to directly, bypassing QPainter. Only
+// available while the painter is on a 32 bit raster target with an integer
+// translation, SourceOver and at most a rectangular clip.
+struct DirectTarget
+{
+    QImage *image;
+    QPoint offset;
+    QRect clipRect;
+    int opacity;
+};
+
+// The painter's clip in device coordinates. The rendering visitor keeps it
+// up to date as it enters clip nodes, so nodes never query the clip region.
+struct DirectClip
+{
+    DirectClip() : clipped(false), complex(false) {}
+
+    static DirectClip fromPainter(QPainter *painter);
+    DirectClip intersected(QPainter *painter, const QRectF &rect) const;
+
+    bool clipped;
+    // Set when the clip is not a set of device aligned rects
+    bool complex;
+    QVector<QRect> rects;
+};
+
+// bounds are the logical coordinates the node is going to draw to; the
+// clip is reduced to the one clip rect they touch, if there is only one.
+bool directTarget(QPainter *painter, const DirectClip &clip, const QRect &bounds, DirectTarget *target);
+
+// Fills an axis aligned rect with a premultiplied color, honoring the clip.
+void fillRect(const DirectTarget &target, const QRect &rect, QRgb color);
+
+// Colors are premultiplied. fillRows optionally gives one fill color per row
+// of the rect inside the border, for vertical gradients. Returns false without
+// drawing anything if the radius is too large for the coverage tables.
+bool fillRoundedRect(const DirectTarget &target, const QRect &rect, int radius, int borderWidth,
+                     QRgb borderColor, QRgb fillColor, const QRgb *fillRows = 0);
+
+// Blends a premultiplied color through an 8 bit coverage mask (Format_Alpha8)
+// whose top left corner is at pos, honoring the clip and the opacity.
+void blendMask(const DirectTarget &target, const QPoint &pos, const QImage &mask, QRgb color);
+
+// Copies sourceRect of an opaque RGB32 pixmap to pos, honoring the clip.
+// Returns false without drawing anything if the pixmap is not an RGB32 raster
+// pixmap or the target is not fully opaque.
+bool blitOpaque(const DirectTarget &target, const QPoint &pos, const QPixmap &pixmap, const QRect &sourceRect);
+
+} // namespace
+
+#endif // SPANFILLER_H
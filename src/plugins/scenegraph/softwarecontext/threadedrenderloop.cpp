@@ -55,6 +55,7 @@
 #include <private/qqmldebugserviceinterfaces_p.h>
 #include <private/qqmldebugconnector_p.h>
 #include "context.h"
+#include "painternode.h"
 
 /*
    Overall design:
@@ -409,6 +410,7 @@ bool RenderThread::event(QEvent *e)
             QQuickWindowPrivate *d = QQuickWindowPrivate::get(window);
             static_cast<SoftwareContext::RenderContext*>(d->context)->currentWindow = window;
             d->syncSceneGraph();
+            PainterNode::finishThreadedPainting(static_cast<SoftwareContext::RenderContext*>(d->context));
 
             qCDebug(QSG_RASTER_LOG_RENDERLOOP) << QSG_RT_PAD << "- rendering scene graph";
             QQuickWindowPrivate::get(window)->renderSceneGraph(windowSize);
@@ -471,6 +473,9 @@ void RenderThread::sync(bool inExpose)
         if (d->renderer)
             d->renderer->clearChangedFlag();
         d->syncSceneGraph();
+        PainterNode::finishThreadedPainting(static_cast<SoftwareContext::RenderContext*>(d->context));
+        if (inExpose && d->renderer)
+            static_cast<SoftwareContext::Renderer*>(d->renderer)->markFullRepaint();
         if (!hadRenderer && d->renderer) {
             qCDebug(QSG_RASTER_LOG_RENDERLOOP) << QSG_RT_PAD << "- renderer was created";
             syncResultedInChanges = true;